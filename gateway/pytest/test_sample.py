@@ -5,6 +5,7 @@
 #
 
 import logging
+import re
 
 import pytest
 from twister_harness.device.device_adapter import DeviceAdapter
@@ -15,6 +16,11 @@ pytestmark = pytest.mark.anyio
 async def test_setting_project(dut: DeviceAdapter):
     dut.readlines_until("Bluetooth initialized")
 
+    # Bluetooth is started before the cloud connection, so this is measured from boot
+    lines = dut.readlines_until(regex=r"First node sync started \d+ ms after boot")
+    time_ms = int(re.search(r"started (\d+) ms", lines[-1]).group(1))
+    logging.info("Time to first node sync: %d ms", time_ms)
+
     dut.readlines_until("Starting downlink")
 
     dut.readlines_until("Received LED setting: 0")
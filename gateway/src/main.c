@@ -153,13 +153,18 @@ static void bt_connected(struct bt_conn *conn, uint8_t err)
         LOG_ERR("Failed to connect to %s %u %s", addr, err, bt_hci_err_to_str(err));
 
         bt_conn_unref(conn);
-
-        pouch_gateway_scan_start();
         return;
     }
 
     LOG_INF("Connected: %s", addr);
 
+    static bool first_sync = true;
+    if (first_sync)
+    {
+        first_sync = false;
+        LOG_INF("First node sync started %lld ms after boot", k_uptime_get());
+    }
+
     pouch_gateway_bt_start(conn);
 }
 
@@ -173,8 +178,6 @@ static void bt_disconnected(struct bt_conn *conn, uint8_t reason)
     pouch_gateway_bt_stop(conn);
 
     bt_conn_unref(conn);
-
-    pouch_gateway_scan_start();
 }
 
 BT_CONN_CB_DEFINE(conn_callbacks) = {
@@ -192,11 +195,11 @@ int main(void)
     LOG_INF("Gateway Version: " STRINGIFY(GIT_DESCRIBE));
     LOG_INF("Pouch BLE Transport Protocol Version: %d", POUCH_GATT_VERSION);
 
-    connect_to_cloud();
-
-    pouch_gateway_cert_module_on_connected(client);
-    pouch_gateway_uplink_module_init(client);
-    pouch_gateway_downlink_module_init(client);
+    /* Nodes are served with the stored or builtin server cert while the
+       cloud connection is being established */
+    pouch_gateway_cert_module_init();
+    pouch_gateway_uplink_module_init(NULL);
+    pouch_gateway_downlink_module_init(NULL);
 
     int err = bt_enable(NULL);
     if (err)
@@ -207,14 +210,33 @@ int main(void)
 
     LOG_INF("Bluetooth initialized");
 
-    pouch_gateway_scan_start();
+    /* Uplinks are refused until the cloud is connected unless they can be
+       held or spooled, so there is no point in syncing nodes before that */
+    bool scanning = false;
+    if (!IS_ENABLED(CONFIG_POUCH_GATEWAY_CLOUD) || pouch_gateway_uplink_can_buffer())
+    {
+        pouch_gateway_scan_start();
+        scanning = true;
+    }
 
 #ifdef CONFIG_POUCH_GATEWAY_CLOUD
+    connect_to_cloud();
+
     while (true)
     {
-        k_sem_take(&connected, K_FOREVER);
         pouch_gateway_cert_module_on_connected(client);
+        pouch_gateway_uplink_module_on_connected(client);
+
+        if (!scanning)
+        {
+            pouch_gateway_scan_start();
+            scanning = true;
+        }
+
+        k_sem_take(&connected, K_FOREVER);
     }
+#else
+    pouch_gateway_cert_module_on_connected(client);
 #endif
 
     return 0;
@@ -6,7 +6,12 @@
 
 #pragma once
 
+#include <stdint.h>
+
+#include <zephyr/bluetooth/addr.h>
+
 struct bt_conn;
+struct pouch_gateway_uplink;
 
 /**
  * Start certificate exchange for the given Bluetooth connection.
@@ -14,3 +19,58 @@ struct bt_conn;
  * @param conn The Bluetooth connection.
  */
 void pouch_gateway_cert_exchange_start(struct bt_conn *conn);
+
+/**
+ * Release the certificate exchange state of a disconnected node.
+ *
+ * @param conn The Bluetooth connection.
+ */
+void pouch_gateway_cert_cleanup(struct bt_conn *conn);
+
+/**
+ * Pass the server certificate serial hash advertised by a node.
+ *
+ * Must be called before the connection to the node is created, so the hint
+ * is in place however soon the certificate exchange starts. If the hash
+ * matches the current server certificate, the serial isn't read from the
+ * node during the certificate exchange.
+ *
+ * Has no effect unless CONFIG_POUCH_GATEWAY_BT_SERVER_CERT_HINT is enabled.
+ *
+ * @param addr The address of the node.
+ * @param hash CRC-32 of the serial of the node's server certificate.
+ */
+void pouch_gateway_server_cert_hint(const bt_addr_le_t *addr, uint32_t hash);
+
+/**
+ * Drop the server certificate serial hash recorded for a node, if any.
+ *
+ * @param addr The address of the node.
+ */
+void pouch_gateway_server_cert_hint_drop(const bt_addr_le_t *addr);
+
+/**
+ * Attach a newly opened uplink to the node.
+ *
+ * While the device certificate of the node is still being uploaded, the
+ * uplink is held back from the cloud. It is released once the certificate
+ * is accepted, and aborted if it is rejected.
+ *
+ * @param conn The Bluetooth connection.
+ * @param uplink The uplink that was opened for the node.
+ * @return 0 on success, -EACCES if the certificate was rejected, in which
+ *         case the uplink is not attached.
+ */
+int pouch_gateway_device_cert_attach_uplink(struct bt_conn *conn,
+                                            struct pouch_gateway_uplink *uplink);
+
+/**
+ * Forget the device certificate of the node, so it is read and uploaded again
+ * on the next connection.
+ *
+ * Has no effect unless CONFIG_POUCH_GATEWAY_DEVICE_CERT_CACHE is enabled. The cache
+ * is saved to settings from the cert work queue.
+ *
+ * @param conn The Bluetooth connection.
+ */
+void pouch_gateway_device_cert_forget(struct bt_conn *conn);
@@ -21,6 +21,8 @@ struct pouch_gateway_node_info *pouch_gateway_get_node_info(const struct bt_conn
 /**
  * Start Bluetooth operations for the given connection.
  *
+ * Anything left from a previous sync on the same connection is released first.
+ *
  * @param conn The Bluetooth connection.
  */
 void pouch_gateway_bt_start(struct bt_conn *conn);
@@ -28,6 +30,9 @@ void pouch_gateway_bt_start(struct bt_conn *conn);
 /**
  * Stop Bluetooth operations for the given connection.
  *
+ * Releases everything held for the connection. No callbacks for the
+ * connection are run once this returns.
+ *
  * @param conn The Bluetooth connection.
  */
 void pouch_gateway_bt_stop(struct bt_conn *conn);
@@ -17,6 +17,27 @@ struct pouch_gateway_downlink_context;
  */
 struct pouch_gateway_downlink_context *pouch_gateway_downlink_start(struct bt_conn *conn);
 
+/**
+ * Detach the downlink context from the given Bluetooth connection.
+ *
+ * The context stays open, so it can be resumed on another connection with
+ * pouch_gateway_downlink_resume().
+ *
+ * @param conn The Bluetooth connection.
+ * @return Pointer to the detached downlink context, or NULL if there is none.
+ */
+struct pouch_gateway_downlink_context *pouch_gateway_downlink_detach(struct bt_conn *conn);
+
+/**
+ * Resume a detached downlink context on the given Bluetooth connection.
+ *
+ * @param conn The Bluetooth connection.
+ * @param downlink The downlink context returned by pouch_gateway_downlink_detach().
+ * @return 0 on success, negative on error.
+ */
+int pouch_gateway_downlink_resume(struct bt_conn *conn,
+                                  struct pouch_gateway_downlink_context *downlink);
+
 /**
  * Clean up downlink resources for the given Bluetooth connection.
  *
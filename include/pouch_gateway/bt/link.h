@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2025 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+struct bt_conn;
+
+/**
+ * Negotiated parameters of a Bluetooth connection.
+ */
+struct pouch_gateway_bt_link_info
+{
+    /** Connection interval in units of 1.25 ms */
+    uint16_t interval;
+    /** Peripheral latency in connection events */
+    uint16_t latency;
+    /** Supervision timeout in units of 10 ms */
+    uint16_t timeout;
+    /** TX PHY (BT_GAP_LE_PHY_*) */
+    uint8_t tx_phy;
+    /** RX PHY (BT_GAP_LE_PHY_*) */
+    uint8_t rx_phy;
+    /** Maximum TX payload length of the link layer in bytes */
+    uint16_t tx_max_len;
+    /** Maximum RX payload length of the link layer in bytes */
+    uint16_t rx_max_len;
+    /** ATT MTU */
+    uint16_t mtu;
+    /** Uptime in milliseconds when the connection was established */
+    int64_t connected_at;
+};
+
+/**
+ * Tune the link for bulk transfer.
+ *
+ * Requests LE 2M PHY, maximum data length and a fast connection interval.
+ * The requests complete in the background, in parallel with GATT discovery.
+ *
+ * @param conn The Bluetooth connection.
+ */
+void pouch_gateway_bt_link_tune(struct bt_conn *conn);
+
+/**
+ * Get the negotiated parameters of the given connection.
+ *
+ * @param conn The Bluetooth connection.
+ * @return Pointer to the link info of the connection.
+ */
+const struct pouch_gateway_bt_link_info *pouch_gateway_bt_link_info_get(const struct bt_conn *conn);
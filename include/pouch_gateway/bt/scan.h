@@ -6,6 +6,9 @@
 
 #pragma once
 
+/* Length of the optional server certificate serial hash in the advertisement data */
+#define POUCH_GATEWAY_SCAN_SERVER_CERT_HINT_LEN 4
+
 /**
  * Start Bluetooth scanning for devices.
  *
@@ -13,5 +16,15 @@
  * 89a316ae-89b7-4ef6-b1d3-5c9a6e27d272 for backward compatibility) with vendor data indicating:
  * - compatible 'version'
  * - sync request set in 'flags'
+ *
+ * The vendor data may be followed by a little endian CRC-32 (IEEE) of the
+ * serial number of the node's server certificate. If it matches the current
+ * server certificate, the certificate exchange is shortened when the node
+ * is connected (see CONFIG_POUCH_GATEWAY_BT_SERVER_CERT_HINT).
+ *
+ * Nodes requesting a sync are queued and connected to whenever one of the
+ * CONFIG_POUCH_GATEWAY_BT_MAX_CONCURRENT_SYNCS slots is free. Scanning is resumed
+ * automatically after each connection attempt, so there is no need to call this
+ * function again after a node disconnects.
  */
 void pouch_gateway_scan_start(void);
@@ -7,17 +7,34 @@
 #pragma once
 
 struct golioth_client;
+struct k_work;
 struct pouch_gateway_device_cert_context;
 struct pouch_gateway_server_cert_context;
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 /* Max serial number length is 20 bytes according to spec:
  * https://datatracker.ietf.org/doc/html/rfc5280#section-4.1.2.2
  */
 #define CERT_SERIAL_MAXLEN 20
 
+/* SHA-256 of the DER encoded device certificate */
+#define POUCH_GATEWAY_CERT_FINGERPRINT_LEN 32
+
+/**
+ * Callback for when an asynchronous device certificate upload completes.
+ *
+ * @param context The device certificate context, freed after the callback returns.
+ * @param err 0 if the certificate was accepted, negative on error.
+ * @param arg Argument passed to pouch_gateway_device_cert_finish_async().
+ */
+typedef void (*pouch_gateway_device_cert_done_cb)(
+    struct pouch_gateway_device_cert_context *context,
+    int err,
+    void *arg);
+
 /**
  * Start device certificate handling.
  *
@@ -44,6 +61,16 @@ int pouch_gateway_device_cert_push(struct pouch_gateway_device_cert_context *con
  */
 void pouch_gateway_device_cert_abort(struct pouch_gateway_device_cert_context *context);
 
+/**
+ * Compute the fingerprint of the device certificate.
+ *
+ * @param context The device certificate context.
+ * @param[out] fingerprint Buffer of POUCH_GATEWAY_CERT_FINGERPRINT_LEN bytes.
+ * @return 0 on success, negative on error.
+ */
+int pouch_gateway_device_cert_fingerprint(const struct pouch_gateway_device_cert_context *context,
+                                          uint8_t *fingerprint);
+
 /**
  * Finish device certificate handling.
  *
@@ -52,6 +79,20 @@ void pouch_gateway_device_cert_abort(struct pouch_gateway_device_cert_context *c
  */
 int pouch_gateway_device_cert_finish(struct pouch_gateway_device_cert_context *context);
 
+/**
+ * Finish device certificate handling without blocking the caller.
+ *
+ * The certificate is uploaded from a dedicated work queue. The context is
+ * owned by the work queue from here on, and freed after @p done_cb returns.
+ *
+ * @param context The device certificate context.
+ * @param done_cb Callback for when the upload has completed.
+ * @param cb_arg Argument for the callback.
+ */
+void pouch_gateway_device_cert_finish_async(struct pouch_gateway_device_cert_context *context,
+                                            pouch_gateway_device_cert_done_cb done_cb,
+                                            void *cb_arg);
+
 /**
  * Start server certificate handling.
  *
@@ -104,9 +145,43 @@ int pouch_gateway_server_cert_get_data(struct pouch_gateway_server_cert_context
  */
 void pouch_gateway_server_cert_get_serial(void *dst, size_t *dst_len);
 
+/**
+ * Download the server certificate again if the last download is older than
+ * CONFIG_POUCH_GATEWAY_SERVER_CERT_REFRESH_INTERVAL.
+ *
+ * The download runs on the cert work queue. Has no effect before the cloud
+ * is connected.
+ */
+void pouch_gateway_server_cert_refresh(void);
+
+/**
+ * Submit work to the cert work queue.
+ *
+ * For work that blocks, like flash writes, and mustn't run in the Bluetooth
+ * stack's context or on the thread serving a node.
+ *
+ * @param work The work item to submit.
+ */
+void pouch_gateway_cert_work_submit(struct k_work *work);
+
+/**
+ * Initialize the certificate module.
+ *
+ * Loads the server certificate stored by a previous run, if
+ * CONFIG_POUCH_GATEWAY_SERVER_CERT_PERSIST is enabled, or else the builtin
+ * one, if CONFIG_POUCH_GATEWAY_SERVER_CERT_BUILTIN is enabled. This way nodes
+ * can be served before the Golioth client has connected.
+ */
+void pouch_gateway_cert_module_init(void);
+
 /**
  * Callback when connected to Golioth client for certificate module.
  *
+ * Refreshes the server certificate in the background. The certificate is
+ * not downloaded again within CONFIG_POUCH_GATEWAY_SERVER_CERT_REFRESH_INTERVAL
+ * of the last download, and an unchanged certificate isn't sent to nodes
+ * again.
+ *
  * @param client The Golioth client.
  */
 void pouch_gateway_cert_module_on_connected(struct golioth_client *client);
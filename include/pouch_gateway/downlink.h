@@ -29,6 +29,17 @@ struct pouch_gateway_downlink_context *pouch_gateway_downlink_open(
     pouch_gateway_downlink_data_available_cb data_available_cb,
     void *arg);
 
+/**
+ * Replace the data available callback of a downlink context.
+ *
+ * @param downlink The downlink context.
+ * @param data_available_cb Callback for when data is available.
+ * @param arg Argument for the callback.
+ */
+void pouch_gateway_downlink_set_callback(struct pouch_gateway_downlink_context *downlink,
+                                         pouch_gateway_downlink_data_available_cb data_available_cb,
+                                         void *arg);
+
 /**
  * Finish the downlink context.
  *
@@ -9,8 +9,20 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <zephyr/bluetooth/gatt.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
 
 #define POUCH_GATEWAY_BT_ATT_OVERHEAD 3 /* opcode (1) + handle (2) */
+#define POUCH_GATEWAY_BT_GATT_DB_HASH_LEN 16
+
+/* Uplink acknowledgement characteristic, exposed by nodes that support
+   notification based uplink with credits. This is not part of the Pouch
+   GATT protocol yet, see CONFIG_POUCH_GATEWAY_BT_UPLINK_NOTIFY. */
+#ifndef POUCH_GATEWAY_GATT_UUID_UPLINK_ACK_CHRC_VAL
+#define POUCH_GATEWAY_GATT_UUID_UPLINK_ACK_CHRC_VAL \
+    BT_UUID_128_ENCODE(0x89a316ae, 0x89b7, 0x4ef6, 0xb1d3, 0x5c9a6e27d2a0)
+#endif
 
 enum pouch_gateway_gatt_attr
 {
@@ -19,18 +31,41 @@ enum pouch_gateway_gatt_attr
     POUCH_GATEWAY_GATT_ATTR_UPLINK,
     POUCH_GATEWAY_GATT_ATTR_SERVER_CERT,
     POUCH_GATEWAY_GATT_ATTR_DEVICE_CERT,
+    POUCH_GATEWAY_GATT_ATTR_UPLINK_ACK,
 
     POUCH_GATEWAY_GATT_ATTRS,
 };
 
+enum pouch_gateway_uplink_mode
+{
+    POUCH_GATEWAY_UPLINK_MODE_READ,
+    POUCH_GATEWAY_UPLINK_MODE_INDICATE,
+    POUCH_GATEWAY_UPLINK_MODE_NOTIFY,
+};
+
+enum pouch_gateway_uplink_wait
+{
+    POUCH_GATEWAY_UPLINK_WAIT_RESUME,
+    POUCH_GATEWAY_UPLINK_WAIT_UNSUBSCRIBE,
+};
+
+enum pouch_gateway_device_cert_state
+{
+    POUCH_GATEWAY_DEVICE_CERT_ACCEPTED,
+    POUCH_GATEWAY_DEVICE_CERT_PENDING,
+    POUCH_GATEWAY_DEVICE_CERT_REJECTED,
+};
+
 struct pouch_gateway_attr_handle
 {
     uint16_t value;
     uint16_t ccc;
+    uint8_t properties;
 };
 
 struct pouch_gateway_node_info
 {
+    struct bt_conn *conn;
     struct pouch_gateway_attr_handle attr_handles[POUCH_GATEWAY_GATT_ATTRS];
     union
     {
@@ -40,12 +75,35 @@ struct pouch_gateway_node_info
         struct bt_gatt_write_params write_params;
     };
     struct pouch_gateway_downlink_context *downlink_ctx;
-    void *downlink_scratch;
-    void *server_cert_scratch;
+    bool downlink_stream;
+    bool downlink_final_sent;
+    atomic_t downlink_credits;
+    struct k_work_delayable downlink_work;
+    uint32_t downlink_seq;
+    uint8_t *downlink_buf;
+    size_t downlink_buf_len;
+    size_t downlink_pending_len;
     struct pouch_gatt_packetizer *packetizer;
     struct pouch_gateway_uplink *uplink;
+    atomic_t uplink_wait;
+    enum pouch_gateway_uplink_mode uplink_mode;
+    uint16_t uplink_rx_count;
+    uint16_t uplink_credit_limit;
+    struct k_work_delayable uplink_work;
+    bool uplink_started;
+    uint32_t uplink_token;
+    uint32_t uplink_crc;
+    size_t uplink_len;
+    size_t uplink_skip;
+    uint32_t uplink_skip_crc;
+    uint8_t *uplink_resent;
     struct pouch_gateway_device_cert_context *device_cert_ctx;
-    struct pouch_gateway_server_cert_context *server_cert_ctx;
+    enum pouch_gateway_device_cert_state device_cert_state;
+    struct pouch_gateway_server_cert_pdus *server_cert_pdus;
+    size_t server_cert_pdu;
+    size_t server_cert_offset;
+    uint8_t db_hash[POUCH_GATEWAY_BT_GATT_DB_HASH_LEN];
+    bool db_hash_valid;
 };
 
 /**
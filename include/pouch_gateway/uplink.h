@@ -14,8 +14,6 @@
 
 #include <pouch_gateway/downlink.h>
 
-struct pouch_block;
-
 struct pouch_gateway_uplink;
 
 enum pouch_gateway_uplink_result
@@ -26,6 +24,7 @@ enum pouch_gateway_uplink_result
 };
 
 typedef void (*pouch_gateway_uplink_end_cb)(void *arg, enum pouch_gateway_uplink_result res);
+typedef void (*pouch_gateway_uplink_resume_cb)(void *arg);
 
 /**
  * Write data to the uplink.
@@ -35,33 +34,155 @@ typedef void (*pouch_gateway_uplink_end_cb)(void *arg, enum pouch_gateway_uplink
  * @param len The length of the payload.
  * @param is_last true if this is the last chunk.
  * @return 0 on success, negative on error.
+ *
+ * The payload is always accepted when 0 is returned. Check
+ * pouch_gateway_uplink_is_throttled() afterwards to find out whether the
+ * transport should stop receiving data until the resume callback is called.
+ *
+ * Writing the last chunk closes the uplink. It may complete, and the context
+ * be freed, before this function returns, so the context must not be used
+ * after a successful write with @p is_last set.
  */
 int pouch_gateway_uplink_write(struct pouch_gateway_uplink *uplink,
                                const uint8_t *payload,
                                size_t len,
                                bool is_last);
 
+/**
+ * Check if the uplink is throttled.
+ *
+ * An uplink is throttled once CONFIG_POUCH_GATEWAY_UPLINK_HIGH_WATERMARK blocks
+ * are waiting for the cloud, and stays throttled until the number drops to
+ * CONFIG_POUCH_GATEWAY_UPLINK_LOW_WATERMARK.
+ *
+ * @param uplink The uplink context.
+ * @return true if the transport should pause, false otherwise.
+ */
+bool pouch_gateway_uplink_is_throttled(const struct pouch_gateway_uplink *uplink);
+
 /**
  * Open an uplink for the given downlink context.
  *
  * @param downlink The downlink context.
+ * @param end_cb Callback for when the uplink has ended.
+ * @param resume_cb Callback for when a throttled uplink can accept data again.
+ * @param cb_arg Argument for the callbacks.
  * @return Pointer to the uplink context.
  */
 struct pouch_gateway_uplink *pouch_gateway_uplink_open(
     struct pouch_gateway_downlink_context *downlink,
     pouch_gateway_uplink_end_cb end_cb,
-    void *failed_cb_arg);
+    pouch_gateway_uplink_resume_cb resume_cb,
+    void *cb_arg);
 
 /**
  * Close the uplink.
  *
- * @param uplink The uplink context.
+ * The uplink completes once all data has been delivered, which may happen
+ * before this function returns. The context must not be used afterwards.
+ *
+ * @param uplink The uplink context, or NULL.
  */
 void pouch_gateway_uplink_close(struct pouch_gateway_uplink *uplink);
 
+/**
+ * Abort the uplink without completing it.
+ *
+ * Data that was already accepted is discarded, and the end callback is called
+ * with POUCH_GATEWAY_UPLINK_ERROR_LOCAL unless the uplink already failed. The
+ * uplink context must not be used afterwards.
+ *
+ * @param uplink The uplink context.
+ */
+void pouch_gateway_uplink_abort(struct pouch_gateway_uplink *uplink);
+
+/**
+ * Take a reference to the uplink context.
+ *
+ * The context isn't freed until every reference is dropped, even if the
+ * uplink ends in the meantime. Aborting an uplink that has ended has no
+ * effect, so a reference may be used to abort an uplink that could end
+ * concurrently.
+ *
+ * @param uplink The uplink context.
+ */
+void pouch_gateway_uplink_ref(struct pouch_gateway_uplink *uplink);
+
+/**
+ * Drop a reference taken with pouch_gateway_uplink_ref().
+ *
+ * @param uplink The uplink context.
+ */
+void pouch_gateway_uplink_unref(struct pouch_gateway_uplink *uplink);
+
+/**
+ * Hold back data of the uplink from the cloud.
+ *
+ * Data is still accepted and queued while the uplink is held, so the uplink
+ * is throttled once the queue fills up.
+ *
+ * @param uplink The uplink context.
+ */
+void pouch_gateway_uplink_hold(struct pouch_gateway_uplink *uplink);
+
+/**
+ * Resume sending data of a held uplink to the cloud.
+ *
+ * @param uplink The uplink context.
+ */
+void pouch_gateway_uplink_release(struct pouch_gateway_uplink *uplink);
+
+/**
+ * Replace the callbacks of an open uplink.
+ *
+ * Used to hand an uplink over to a different transport connection. Failures
+ * are reported through the new callbacks once this returns, but a resume or
+ * completion that is already being reported may still reach the previous ones.
+ *
+ * @param uplink The uplink context.
+ * @param end_cb Callback for when the uplink has ended.
+ * @param resume_cb Callback for when a throttled uplink can accept data again.
+ * @param cb_arg Argument for the callbacks.
+ */
+void pouch_gateway_uplink_set_callbacks(struct pouch_gateway_uplink *uplink,
+                                        pouch_gateway_uplink_end_cb end_cb,
+                                        pouch_gateway_uplink_resume_cb resume_cb,
+                                        void *cb_arg);
+
 /**
  * Initialize the uplink module with the Golioth client.
  *
- * @param c The Golioth client.
+ * The client may be NULL if nodes are served before it has been created.
+ * Uplinks are then stored in flash if CONFIG_POUCH_GATEWAY_SPOOL is enabled,
+ * and refused otherwise, until a client is passed to
+ * pouch_gateway_uplink_module_on_connected().
+ *
+ * @param c The Golioth client, or NULL.
  */
 void pouch_gateway_uplink_module_init(struct golioth_client *c);
+
+/**
+ * Notify the uplink module that the Golioth client has (re)connected.
+ *
+ * Starts delivering uplinks that were held in RAM or stored in flash while
+ * the cloud was unreachable.
+ *
+ * @param c The Golioth client.
+ */
+void pouch_gateway_uplink_module_on_connected(struct golioth_client *c);
+
+/**
+ * Check if uplinks can be stored in flash while the cloud is unreachable.
+ *
+ * @return true if CONFIG_POUCH_GATEWAY_SPOOL is enabled and the spool was
+ *         initialized by pouch_gateway_uplink_module_init(), false otherwise.
+ */
+bool pouch_gateway_uplink_can_spool(void);
+
+/**
+ * Check if uplinks are accepted while the cloud is unreachable.
+ *
+ * @return true if uplinks are held in RAM (CONFIG_POUCH_GATEWAY_UPLINK_AWAIT_CLOUD)
+ *         or spooled to flash until the cloud is connected, false otherwise.
+ */
+bool pouch_gateway_uplink_can_buffer(void);
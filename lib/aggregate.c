@@ -0,0 +1,346 @@
+/*
+ * Copyright (c) 2025 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+
+#include <golioth/gateway.h>
+
+#include "aggregate.h"
+#include "block.h"
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(aggregate);
+
+/*
+ * Small pouches from different nodes are collected into a batch, which is
+ * uploaded as a single block of its own upload session. Each pouch in the
+ * batch is prefixed with its length (little endian uint16). A batch is sent
+ * once it is full, or CONFIG_POUCH_GATEWAY_UPLINK_AGGREGATE_LATENCY after
+ * its first pouch was added. One batch is filled while the other is sent.
+ *
+ * An acknowledged block only means the cloud stored the batch, not that it
+ * split it into pouches. The cloud acknowledges the batch format by answering
+ * with the number of pouches it accepted (little endian uint16) as downlink
+ * of the batch session. Until then, nodes are not told their pouch was
+ * delivered. Without that answer, the pouches of the batch are uploaded on
+ * their own, and no further batches are collected.
+ */
+
+#define AGGREGATE_LEN_SIZE sizeof(uint16_t)
+#define AGGREGATE_BATCH_SIZE CONFIG_GOLIOTH_BLOCKWISE_UPLOAD_MAX_BLOCK_SIZE
+
+BUILD_ASSERT(CONFIG_POUCH_GATEWAY_UPLINK_AGGREGATE_MAX_POUCH + AGGREGATE_LEN_SIZE
+                 <= AGGREGATE_BATCH_SIZE,
+             "Aggregated pouches must fit into a single block");
+
+struct aggregate_entry
+{
+    aggregate_done_cb done_cb;
+    void *arg;
+};
+
+struct aggregate_batch
+{
+    uint8_t buf[AGGREGATE_BATCH_SIZE];
+    size_t len;
+    struct aggregate_entry entries[CONFIG_POUCH_GATEWAY_UPLINK_AGGREGATE_MAX_POUCHES];
+    size_t count;
+    struct gateway_uplink *session;
+    uint32_t seq;
+    bool block_acked;
+    uint8_t ack[sizeof(uint16_t)];
+    size_t ack_len;
+};
+
+static struct golioth_client *client;
+static struct aggregate_batch batches[2];
+static struct aggregate_batch *filling = &batches[0];
+static struct aggregate_batch *sending;
+static uint32_t batch_seq;
+static bool batches_unacknowledged;
+static K_MUTEX_DEFINE(aggregate_lock);
+
+static void flush_work_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(flush_work, flush_work_handler);
+
+static bool batch_is_full(const struct aggregate_batch *batch)
+{
+    return batch->count == ARRAY_SIZE(batch->entries)
+        || batch->len + AGGREGATE_LEN_SIZE >= sizeof(batch->buf);
+}
+
+/* Takes the entries out of a batch, so their callbacks can be called
+   without holding aggregate_lock. Must be called with aggregate_lock held. */
+static size_t batch_take(struct aggregate_batch *batch, struct aggregate_entry *entries)
+{
+    size_t count = batch->count;
+
+    memcpy(entries, batch->entries, count * sizeof(*entries));
+    batch->count = 0;
+    batch->len = 0;
+    batch->session = NULL;
+    batch->block_acked = false;
+    batch->ack_len = 0;
+
+    return count;
+}
+
+static void batch_done(struct aggregate_entry *entries,
+                       size_t count,
+                       enum aggregate_result result)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        entries[i].done_cb(entries[i].arg, result);
+    }
+}
+
+/* Callbacks of a batch session may arrive after the batch completed, and its
+   buffer was reused. Must be called with aggregate_lock held. */
+static struct aggregate_batch *batch_in_flight(void *arg)
+{
+    if (sending != NULL && sending->seq == (uint32_t) (uintptr_t) arg)
+    {
+        return sending;
+    }
+
+    return NULL;
+}
+
+static void batch_complete(void *arg, enum aggregate_result result)
+{
+    struct aggregate_entry entries[CONFIG_POUCH_GATEWAY_UPLINK_AGGREGATE_MAX_POUCHES];
+
+    k_mutex_lock(&aggregate_lock, K_FOREVER);
+
+    struct aggregate_batch *batch = batch_in_flight(arg);
+    if (batch == NULL)
+    {
+        k_mutex_unlock(&aggregate_lock);
+        return;
+    }
+
+    if (!batch->block_acked)
+    {
+        golioth_gateway_uplink_finish(batch->session);
+    }
+
+    size_t count = batch_take(batch, entries);
+    sending = NULL;
+
+    /* The next batch may have become due while this one was sent */
+    if (filling->count > 0 && (batch_is_full(filling) || !k_work_delayable_is_pending(&flush_work)))
+    {
+        k_work_reschedule(&flush_work, K_NO_WAIT);
+    }
+
+    k_mutex_unlock(&aggregate_lock);
+
+    batch_done(entries, count, result);
+}
+
+static enum golioth_status batch_downlink_block_cb(const uint8_t *data,
+                                                   size_t len,
+                                                   bool is_last,
+                                                   void *arg)
+{
+    k_mutex_lock(&aggregate_lock, K_FOREVER);
+
+    struct aggregate_batch *batch = batch_in_flight(arg);
+    if (batch != NULL)
+    {
+        /* Anything but the pouch count leaves the batch unacknowledged */
+        if (batch->ack_len + len <= sizeof(batch->ack))
+        {
+            memcpy(&batch->ack[batch->ack_len], data, len);
+        }
+
+        batch->ack_len += len;
+    }
+
+    k_mutex_unlock(&aggregate_lock);
+
+    return GOLIOTH_OK;
+}
+
+static void batch_downlink_end_cb(enum golioth_status status,
+                                  const struct golioth_coap_rsp_code *coap_rsp_code,
+                                  void *arg)
+{
+    enum aggregate_result result = AGGREGATE_FAILED;
+
+    k_mutex_lock(&aggregate_lock, K_FOREVER);
+
+    struct aggregate_batch *batch = batch_in_flight(arg);
+    if (batch != NULL && batch->block_acked)
+    {
+        if (status == GOLIOTH_OK && batch->ack_len == sizeof(batch->ack)
+            && sys_get_le16(batch->ack) == batch->count)
+        {
+            result = AGGREGATE_DELIVERED;
+        }
+        else
+        {
+            result = AGGREGATE_UNACKNOWLEDGED;
+        }
+
+        /* A downlink lost on the way says nothing about the batch format */
+        bool answered = status == GOLIOTH_OK || status == GOLIOTH_ERR_COAP_RESPONSE;
+        if (result == AGGREGATE_UNACKNOWLEDGED && answered && !batches_unacknowledged)
+        {
+            LOG_WRN("Cloud didn't acknowledge the batch format, uploading pouches on their own");
+            batches_unacknowledged = true;
+        }
+    }
+
+    k_mutex_unlock(&aggregate_lock);
+
+    /* Done callbacks take the uplink locks, which are held while submitting */
+    batch_complete(arg, result);
+}
+
+static void batch_sent_cb(struct golioth_client *client,
+                          enum golioth_status status,
+                          const struct golioth_coap_rsp_code *coap_rsp_code,
+                          const char *path,
+                          size_t block_size,
+                          void *arg)
+{
+    if (status != GOLIOTH_OK)
+    {
+        LOG_ERR("Failed to deliver batch: %d", status);
+        batch_complete(arg, AGGREGATE_FAILED);
+        return;
+    }
+
+    k_mutex_lock(&aggregate_lock, K_FOREVER);
+
+    /* The batch completes once the cloud answered with the pouch count */
+    struct aggregate_batch *batch = batch_in_flight(arg);
+    if (batch != NULL)
+    {
+        golioth_gateway_uplink_finish(batch->session);
+        batch->block_acked = true;
+    }
+
+    k_mutex_unlock(&aggregate_lock);
+}
+
+static void flush_work_handler(struct k_work *work)
+{
+    struct aggregate_entry entries[CONFIG_POUCH_GATEWAY_UPLINK_AGGREGATE_MAX_POUCHES];
+
+    k_mutex_lock(&aggregate_lock, K_FOREVER);
+
+    if (sending != NULL || filling->count == 0)
+    {
+        /* Rescheduled once the batch in flight completes */
+        k_mutex_unlock(&aggregate_lock);
+        return;
+    }
+
+    struct aggregate_batch *batch = filling;
+    filling = (filling == &batches[0]) ? &batches[1] : &batches[0];
+
+    LOG_DBG("Sending batch of %zu pouches, %zu bytes", batch->count, batch->len);
+
+    /* Zero is never used, so no callback mistakes it for a batch */
+    batch_seq = MAX(batch_seq + 1, 1);
+    batch->seq = batch_seq;
+    void *arg = (void *) (uintptr_t) batch->seq;
+
+    batch->session = golioth_gateway_uplink_start(client,
+                                                  batch_downlink_block_cb,
+                                                  batch_downlink_end_cb,
+                                                  arg);
+    if (batch->session == NULL)
+    {
+        LOG_ERR("Failed to start blockwise upload");
+
+        size_t count = batch_take(batch, entries);
+        k_mutex_unlock(&aggregate_lock);
+
+        batch_done(entries, count, AGGREGATE_FAILED);
+        return;
+    }
+
+    /* The callback may run before golioth_gateway_uplink_block() returns */
+    sending = batch;
+
+    enum golioth_status status = golioth_gateway_uplink_block(batch->session,
+                                                              0,
+                                                              batch->buf,
+                                                              batch->len,
+                                                              true,
+                                                              batch_sent_cb,
+                                                              arg);
+    if (status != GOLIOTH_OK)
+    {
+        LOG_ERR("Failed to deliver batch: %d", status);
+
+        k_mutex_unlock(&aggregate_lock);
+
+        batch_complete(arg, AGGREGATE_FAILED);
+        return;
+    }
+
+    k_mutex_unlock(&aggregate_lock);
+}
+
+void aggregate_init(struct golioth_client *c)
+{
+    client = c;
+}
+
+int aggregate_submit(const struct block *block, aggregate_done_cb done_cb, void *arg)
+{
+    size_t len = block_length(block);
+
+    if (len > CONFIG_POUCH_GATEWAY_UPLINK_AGGREGATE_MAX_POUCH)
+    {
+        return -EMSGSIZE;
+    }
+
+    k_mutex_lock(&aggregate_lock, K_FOREVER);
+
+    if (batches_unacknowledged)
+    {
+        k_mutex_unlock(&aggregate_lock);
+        return -ENOTSUP;
+    }
+
+    if (batch_is_full(filling) || filling->len + AGGREGATE_LEN_SIZE + len > sizeof(filling->buf))
+    {
+        /* Both batches are busy, the caller uploads the pouch on its own */
+        k_mutex_unlock(&aggregate_lock);
+        return -EBUSY;
+    }
+
+    sys_put_le16(len, &filling->buf[filling->len]);
+    block_get(block, 0, &filling->buf[filling->len + AGGREGATE_LEN_SIZE], len);
+    filling->len += AGGREGATE_LEN_SIZE + len;
+
+    filling->entries[filling->count].done_cb = done_cb;
+    filling->entries[filling->count].arg = arg;
+    filling->count++;
+
+    if (batch_is_full(filling))
+    {
+        k_work_reschedule(&flush_work, K_NO_WAIT);
+    }
+    else if (filling->count == 1)
+    {
+        k_work_reschedule(&flush_work, K_MSEC(CONFIG_POUCH_GATEWAY_UPLINK_AGGREGATE_LATENCY));
+    }
+
+    k_mutex_unlock(&aggregate_lock);
+
+    return 0;
+}
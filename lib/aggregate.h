@@ -0,0 +1,28 @@
+/*
+ * Copyright (c) 2025 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+struct block;
+struct golioth_client;
+
+enum aggregate_result
+{
+    /* The cloud split the batch and accepted every pouch in it */
+    AGGREGATE_DELIVERED,
+    /* The batch didn't reach the cloud */
+    AGGREGATE_FAILED,
+    /* The cloud didn't acknowledge the batch format, the pouch has to be
+       uploaded on its own */
+    AGGREGATE_UNACKNOWLEDGED,
+};
+
+typedef void (*aggregate_done_cb)(void *arg, enum aggregate_result result);
+
+void aggregate_init(struct golioth_client *client);
+int aggregate_submit(const struct block *block, aggregate_done_cb done_cb, void *arg);
@@ -11,53 +11,293 @@
 #include <errno.h>
 
 #include <zephyr/kernel.h>
-#include <zephyr/sys/sflist.h>
+#include <zephyr/sys/slist.h>
 
 #include "block.h"
 
-enum block_flags
+#define FRAG_SIZE CONFIG_POUCH_GATEWAY_BLOCK_FRAGMENT_SIZE
+
+/*
+ * A block holds up to CONFIG_GOLIOTH_BLOCKWISE_UPLOAD_MAX_BLOCK_SIZE bytes in
+ * a chain of fragments, which are only allocated as data is appended. Small
+ * pouches therefore only pin the fragments they actually use. Accounts are
+ * charged per fragment.
+ */
+
+struct block_frag
 {
-    BLOCK_LAST = 0,
+    struct block_frag *next;
+    uint8_t data[FRAG_SIZE];
 };
 
 struct block
 {
-    sys_sfnode_t node;
-    void *user_data;
+    sys_snode_t node;
+    struct block_account *account;
     struct
     {
         uint8_t is_last : 1;
     } flags;
     size_t len;
-    uint8_t data[CONFIG_GOLIOTH_BLOCKWISE_UPLOAD_MAX_BLOCK_SIZE];
+    struct block_frag *head;
+    struct block_frag *tail;
 };
 
 K_MEM_SLAB_DEFINE_STATIC(block_slab, sizeof(struct block), CONFIG_POUCH_GATEWAY_NUM_BLOCKS, 4);
+K_MEM_SLAB_DEFINE_STATIC(frag_slab,
+                         sizeof(struct block_frag),
+                         CONFIG_POUCH_GATEWAY_NUM_BLOCK_FRAGMENTS,
+                         4);
+
+static struct k_spinlock pool_lock;
+static size_t pool_reserved;
+static size_t pool_shared_used;
+static size_t pool_spare;
+static unsigned int pool_weight;
+
+static size_t shared_used(const struct block_account *account)
+{
+    return account->used > account->reserved ? account->used - account->reserved : 0;
+}
+
+/* The unused part of the reserve, which the account holds as spares */
+static size_t spare_target(const struct block_account *account)
+{
+    return account->reserved - MIN(account->used, account->reserved);
+}
+
+/* Must be called with pool_lock held */
+static void spare_put(struct block_account *account, struct block_frag *frag)
+{
+    frag->next = account->spare;
+    account->spare = frag;
+    account->spare_count++;
+    pool_spare++;
+}
+
+/* Must be called with pool_lock held */
+static struct block_frag *spare_get(struct block_account *account)
+{
+    struct block_frag *frag = account->spare;
+
+    if (NULL != frag)
+    {
+        account->spare = frag->next;
+        account->spare_count--;
+        pool_spare--;
+    }
+
+    return frag;
+}
+
+/* Brings the spares back in line with the unused reserve, after blocks were
+   moved between accounts. Must be called with pool_lock held. */
+static void spare_balance(struct block_account *account)
+{
+    struct block_frag *frag;
+
+    while (account->spare_count > spare_target(account))
+    {
+        k_mem_slab_free(&frag_slab, spare_get(account));
+    }
+
+    while (account->spare_count < spare_target(account)
+           && 0 == k_mem_slab_alloc(&frag_slab, (void **) &frag, K_NO_WAIT))
+    {
+        spare_put(account, frag);
+    }
+}
+
+void block_account_open(struct block_account *account, unsigned int weight)
+{
+    K_SPINLOCK(&pool_lock)
+    {
+        account->used = 0;
+        account->max_used = 0;
+        account->failed = 0;
+        account->weight = MAX(weight, 1);
+        account->spare = NULL;
+        account->spare_count = 0;
+
+        /* Only fragments that no other account reserved or uses are
+           reserved, and they're taken from the pool right away, so the
+           reserve is there when the account needs it */
+        size_t unreserved = CONFIG_POUCH_GATEWAY_NUM_BLOCK_FRAGMENTS - pool_reserved;
+        size_t available = unreserved - MIN(unreserved, pool_shared_used);
+        struct block_frag *frag;
+
+        while (account->spare_count < MIN(CONFIG_POUCH_GATEWAY_BLOCK_RESERVED, available)
+               && 0 == k_mem_slab_alloc(&frag_slab, (void **) &frag, K_NO_WAIT))
+        {
+            spare_put(account, frag);
+        }
+
+        account->reserved = account->spare_count;
+
+        pool_reserved += account->reserved;
+        pool_weight += account->weight;
+    }
+}
+
+/* All blocks of the account must have been freed */
+void block_account_close(struct block_account *account)
+{
+    K_SPINLOCK(&pool_lock)
+    {
+        struct block_frag *frag;
+
+        while (NULL != (frag = spare_get(account)))
+        {
+            k_mem_slab_free(&frag_slab, frag);
+        }
+
+        pool_reserved -= account->reserved;
+        pool_weight -= account->weight;
+    }
+}
 
-struct block *block_alloc(void *user_data, k_timeout_t timeout)
+/* Must be called with pool_lock held */
+static void charge(struct block_account *account)
+{
+    if (account->used >= account->reserved)
+    {
+        pool_shared_used++;
+    }
+    account->used++;
+    account->max_used = MAX(account->max_used, account->used);
+}
+
+/* Must be called with pool_lock held */
+static void uncharge(struct block_account *account)
+{
+    if (account->used > account->reserved)
+    {
+        pool_shared_used--;
+    }
+    account->used--;
+}
+
+/* Must be called with pool_lock held */
+static struct block_frag *frag_alloc(struct block_account *account)
+{
+    struct block_frag *frag = NULL;
+
+    if (account->used >= account->reserved)
+    {
+        size_t shared = CONFIG_POUCH_GATEWAY_NUM_BLOCK_FRAGMENTS - pool_reserved;
+        size_t fair_share = MAX(shared * account->weight / pool_weight, 1);
+
+        if (pool_shared_used >= shared || shared_used(account) >= fair_share)
+        {
+            return NULL;
+        }
+    }
+    else
+    {
+        frag = spare_get(account);
+    }
+
+    if (NULL == frag && 0 != k_mem_slab_alloc(&frag_slab, (void **) &frag, K_NO_WAIT))
+    {
+        return NULL;
+    }
+
+    charge(account);
+
+    frag->next = NULL;
+
+    return frag;
+}
+
+/* Must be called with pool_lock held */
+static void frag_free(struct block_account *account, struct block_frag *frag)
+{
+    uncharge(account);
+
+    /* Fragments of the reserve go back to the account */
+    if (account->spare_count < spare_target(account))
+    {
+        spare_put(account, frag);
+        return;
+    }
+
+    k_mem_slab_free(&frag_slab, frag);
+}
+
+struct block *block_alloc(struct block_account *account)
 {
     struct block *block = NULL;
-    int err = k_mem_slab_alloc(&block_slab, (void **) &block, timeout);
-    if (0 == err)
+
+    if (0 != k_mem_slab_alloc(&block_slab, (void **) &block, K_NO_WAIT))
     {
-        block->flags.is_last = 0;
-        block->len = 0;
-        block->user_data = user_data;
+        K_SPINLOCK(&pool_lock)
+        {
+            account->failed++;
+        }
+
+        return NULL;
     }
 
+    block->flags.is_last = 0;
+    block->len = 0;
+    block->account = account;
+    block->head = NULL;
+    block->tail = NULL;
+
     return block;
 }
 
 void block_free(struct block *block)
 {
+    K_SPINLOCK(&pool_lock)
+    {
+        struct block_frag *frag = block->head;
+        while (NULL != frag)
+        {
+            struct block_frag *next = frag->next;
+
+            frag_free(block->account, frag);
+            frag = next;
+        }
+    }
+
     k_mem_slab_free(&block_slab, block);
 }
 
+/* Charges the fragments of the block to another account. The account may
+   go over its share, as the fragments are already allocated. */
+void block_move(struct block *block, struct block_account *account)
+{
+    K_SPINLOCK(&pool_lock)
+    {
+        for (struct block_frag *frag = block->head; NULL != frag; frag = frag->next)
+        {
+            uncharge(block->account);
+            charge(account);
+        }
+
+        spare_balance(block->account);
+        spare_balance(account);
+
+        block->account = account;
+    }
+}
+
+struct block_account *block_owner(const struct block *block)
+{
+    return block->account;
+}
+
 size_t block_length(const struct block *block)
 {
     return block->len;
 }
 
+size_t block_space(const struct block *block)
+{
+    return CONFIG_GOLIOTH_BLOCKWISE_UPLOAD_MAX_BLOCK_SIZE - block->len;
+}
+
 void block_mark_last(struct block *block)
 {
     block->flags.is_last = true;
@@ -68,20 +308,214 @@ bool block_is_last(const struct block *block)
     return 1 == block->flags.is_last;
 }
 
-void block_append(struct block *block, const void *data, size_t data_len)
+int block_append(struct block *block, const void *data, size_t data_len)
 {
-    memcpy(block->data + block->len, data, data_len);
-    block->len += data_len;
+    if (data_len > block_space(block))
+    {
+        return -EINVAL;
+    }
+
+    size_t tail_space = block->tail ? (FRAG_SIZE - (block->len - 1) % FRAG_SIZE - 1) : 0;
+    size_t frags_needed = DIV_ROUND_UP(data_len - MIN(data_len, tail_space), FRAG_SIZE);
+    struct block_frag *new_frags = NULL;
+    struct block_frag *new_tail = NULL;
+    int err = 0;
+
+    /* Allocate everything up front, so a failed append leaves the block intact */
+    K_SPINLOCK(&pool_lock)
+    {
+        for (size_t i = 0; i < frags_needed; i++)
+        {
+            struct block_frag *frag = frag_alloc(block->account);
+            if (NULL == frag)
+            {
+                block->account->failed++;
+                err = -ENOMEM;
+                break;
+            }
+
+            if (NULL == new_tail)
+            {
+                new_frags = frag;
+            }
+            else
+            {
+                new_tail->next = frag;
+            }
+            new_tail = frag;
+        }
+
+        if (err)
+        {
+            while (NULL != new_frags)
+            {
+                struct block_frag *next = new_frags->next;
+
+                frag_free(block->account, new_frags);
+                new_frags = next;
+            }
+        }
+    }
+
+    if (err)
+    {
+        return err;
+    }
+
+    if (NULL == block->tail)
+    {
+        block->head = new_frags;
+        block->tail = new_tail;
+    }
+    else if (NULL != new_frags)
+    {
+        block->tail->next = new_frags;
+    }
+
+    const uint8_t *src = data;
+    struct block_frag *frag = tail_space ? block->tail : new_frags;
+    size_t frag_offset = tail_space ? FRAG_SIZE - tail_space : 0;
+
+    while (data_len)
+    {
+        size_t chunk = MIN(data_len, FRAG_SIZE - frag_offset);
+
+        memcpy(&frag->data[frag_offset], src, chunk);
+
+        block->len += chunk;
+        src += chunk;
+        data_len -= chunk;
+
+        if (data_len)
+        {
+            frag = frag->next;
+            frag_offset = 0;
+        }
+    }
+
+    if (NULL != new_tail)
+    {
+        block->tail = new_tail;
+    }
+
+    return 0;
 }
 
 int block_get(const struct block *block, size_t offset, void *buf, size_t len)
 {
-    if (offset + len > CONFIG_GOLIOTH_BLOCKWISE_UPLOAD_MAX_BLOCK_SIZE)
+    if (offset + len > block->len)
     {
         return -EINVAL;
     }
 
-    memcpy(buf, block->data + offset, len);
+    const struct block_frag *frag = block->head;
+    uint8_t *dst = buf;
+
+    while (offset >= FRAG_SIZE)
+    {
+        frag = frag->next;
+        offset -= FRAG_SIZE;
+    }
+
+    while (len)
+    {
+        size_t chunk = MIN(len, FRAG_SIZE - offset);
+
+        memcpy(dst, &frag->data[offset], chunk);
+
+        dst += chunk;
+        len -= chunk;
+        offset = 0;
+        frag = frag->next;
+    }
+
+    return 0;
+}
+
+size_t block_span(const struct block *block, size_t offset, const void **data)
+{
+    const struct block_frag *frag = block->head;
+
+    if (offset >= block->len)
+    {
+        *data = NULL;
+        return 0;
+    }
+
+    size_t remaining = block->len - offset;
+
+    while (offset >= FRAG_SIZE)
+    {
+        frag = frag->next;
+        offset -= FRAG_SIZE;
+    }
 
+    *data = &frag->data[offset];
+
+    return MIN(FRAG_SIZE - offset, remaining);
+}
+
+void block_queue_append(sys_slist_t *queue, struct block *block)
+{
+    sys_slist_append(queue, &block->node);
+}
+
+struct block *block_queue_get(sys_slist_t *queue)
+{
+    sys_snode_t *node = sys_slist_get(queue);
+
+    return node ? CONTAINER_OF(node, struct block, node) : NULL;
+}
+
+bool block_equals(const struct block *block, const void *data, size_t len)
+{
+    if (block->len != len)
+    {
+        return false;
+    }
+
+    const uint8_t *src = data;
+    for (struct block_frag *frag = block->head; NULL != frag; frag = frag->next)
+    {
+        size_t frag_len = MIN(len, FRAG_SIZE);
+
+        if (0 != memcmp(frag->data, src, frag_len))
+        {
+            return false;
+        }
+
+        src += frag_len;
+        len -= frag_len;
+    }
+
+    return true;
+}
+
+struct block *block_queue_peek(sys_slist_t *queue)
+{
+    sys_snode_t *node = sys_slist_peek_head(queue);
+
+    return node ? CONTAINER_OF(node, struct block, node) : NULL;
+}
+
+/* Spares hold no data, so they don't count as used */
+size_t block_pool_used(void)
+{
+    size_t used;
+
+    K_SPINLOCK(&pool_lock)
+    {
+        used = k_mem_slab_num_used_get(&frag_slab) - pool_spare;
+    }
+
+    return used;
+}
+
+size_t block_pool_max_used(void)
+{
+#ifdef CONFIG_MEM_SLAB_TRACE_MAX_UTILIZATION
+    return k_mem_slab_max_used_get(&frag_slab);
+#else
     return 0;
+#endif
 }
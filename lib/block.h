@@ -9,13 +9,48 @@
 #include <stdbool.h>
 
 #include <zephyr/kernel.h>
+#include <zephyr/sys/slist.h>
 
 struct block;
+struct block_frag;
 
-struct block *block_alloc(void *user_data, k_timeout_t timeout);
+/* Blocks are allocated on behalf of an account, one per uplink or downlink
+   session, and charged per fragment of block data. An account may always use
+   its reserved fragments, which are taken from the pool when it is opened and
+   kept as spares while unused. Beyond that it may use a share of the remaining
+   fragments proportional to its weight. */
+struct block_account
+{
+    size_t used;
+    size_t max_used;
+    size_t reserved;
+    size_t failed;
+    unsigned int weight;
+    struct block_frag *spare;
+    size_t spare_count;
+};
+
+void block_account_open(struct block_account *account, unsigned int weight);
+void block_account_close(struct block_account *account);
+
+struct block *block_alloc(struct block_account *account);
 void block_free(struct block *block);
+void block_move(struct block *block, struct block_account *account);
+struct block_account *block_owner(const struct block *block);
 size_t block_length(const struct block *block);
+size_t block_space(const struct block *block);
 void block_mark_last(struct block *block);
 bool block_is_last(const struct block *block);
-void block_append(struct block *block, const void *data, size_t data_len);
+int block_append(struct block *block, const void *data, size_t data_len);
 int block_get(const struct block *block, size_t offset, void *buf, size_t len);
+bool block_equals(const struct block *block, const void *data, size_t len);
+
+/* Get the contiguous data starting at offset, returns its length */
+size_t block_span(const struct block *block, size_t offset, const void **data);
+
+void block_queue_append(sys_slist_t *queue, struct block *block);
+struct block *block_queue_get(sys_slist_t *queue);
+struct block *block_queue_peek(sys_slist_t *queue);
+
+size_t block_pool_used(void);
+size_t block_pool_max_used(void);
@@ -9,6 +9,8 @@
 #include <zephyr/bluetooth/bluetooth.h>
 #include <zephyr/bluetooth/conn.h>
 #include <zephyr/bluetooth/gatt.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/sys/crc.h>
 
 #include <pouch/transport/gatt/common/packetizer.h>
 
@@ -17,6 +19,7 @@
 #include <pouch_gateway/bt/uplink.h>
 
 #include <pouch_gateway/cert.h>
+#include <pouch_gateway/uplink.h>
 
 #include <zephyr/logging/log.h>
 LOG_MODULE_REGISTER(cert_gatt);
@@ -28,26 +31,518 @@ static void write_response_cb(struct bt_conn *conn,
                               uint8_t err,
                               struct bt_gatt_write_params *params);
 
-static void server_cert_cleanup(struct bt_conn *conn)
+/* Orders the device cert upload result against the uplink being opened */
+static K_MUTEX_DEFINE(device_cert_lock);
+
+#ifdef CONFIG_POUCH_GATEWAY_DEVICE_CERT_CACHE
+
+/*
+ * Device certificates that were uploaded are remembered by node address and
+ * fingerprint. The table is stored in settings, the read times are not, so
+ * after a reboot every node's certificate is read once more, but only
+ * uploaded if it changed.
+ */
+
+#define CERT_CACHE_SETTINGS_KEY "pouch_gw/device_certs"
+
+struct cert_cache_entry
 {
-    struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
+    bt_addr_le_t addr;
+    uint8_t fingerprint[POUCH_GATEWAY_CERT_FINGERPRINT_LEN];
+};
+
+static struct cert_cache_entry cert_cache[CONFIG_POUCH_GATEWAY_DEVICE_CERT_CACHE_SIZE];
+static int64_t cert_cache_read_at[CONFIG_POUCH_GATEWAY_DEVICE_CERT_CACHE_SIZE];
+static K_MUTEX_DEFINE(cert_cache_lock);
+
+static int cert_cache_settings_set(const char *name,
+                                   size_t len,
+                                   settings_read_cb read_cb,
+                                   void *cb_arg)
+{
+    if (len > sizeof(cert_cache))
+    {
+        len = sizeof(cert_cache);
+    }
+
+    k_mutex_lock(&cert_cache_lock, K_FOREVER);
+    ssize_t ret = read_cb(cb_arg, cert_cache, len);
+    k_mutex_unlock(&cert_cache_lock);
+
+    return ret < 0 ? ret : 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(pouch_gw_device_certs,
+                               CERT_CACHE_SETTINGS_KEY,
+                               NULL,
+                               cert_cache_settings_set,
+                               NULL,
+                               NULL);
+
+/* Must be called with cert_cache_lock held */
+static int cert_cache_find(const bt_addr_le_t *addr)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(cert_cache); i++)
+    {
+        if (bt_addr_le_eq(&cert_cache[i].addr, addr))
+        {
+            return i;
+        }
+    }
+
+    return -ENOENT;
+}
+
+/* The table is written from the cert work queue, so neither the thread
+   serving the node nor cert_cache_lock are held up by the flash */
+static void cert_cache_save_handler(struct k_work *work)
+{
+    static struct cert_cache_entry saved[ARRAY_SIZE(cert_cache)];
+
+    k_mutex_lock(&cert_cache_lock, K_FOREVER);
+    memcpy(saved, cert_cache, sizeof(saved));
+    k_mutex_unlock(&cert_cache_lock);
+
+    int err = settings_save_one(CERT_CACHE_SETTINGS_KEY, saved, sizeof(saved));
+    if (err)
+    {
+        LOG_WRN("Failed to save device cert cache: %d", err);
+    }
+}
+
+static K_WORK_DEFINE(cert_cache_save_work, cert_cache_save_handler);
+
+static void cert_cache_save(void)
+{
+    pouch_gateway_cert_work_submit(&cert_cache_save_work);
+}
+
+/* Whether the node's certificate was read recently enough to skip reading it */
+static bool cert_cache_is_fresh(struct bt_conn *conn)
+{
+    bool fresh = false;
+
+    if (0 == CONFIG_POUCH_GATEWAY_DEVICE_CERT_CACHE_TTL)
+    {
+        return false;
+    }
+
+    k_mutex_lock(&cert_cache_lock, K_FOREVER);
+
+    int idx = cert_cache_find(bt_conn_get_dst(conn));
+    if (idx >= 0 && cert_cache_read_at[idx] != 0)
+    {
+        fresh = k_uptime_get() - cert_cache_read_at[idx]
+            < (int64_t) CONFIG_POUCH_GATEWAY_DEVICE_CERT_CACHE_TTL * MSEC_PER_SEC;
+    }
+
+    k_mutex_unlock(&cert_cache_lock);
+
+    return fresh;
+}
+
+/* Whether this certificate was already uploaded for the node. Refreshes the
+   read time if it was. */
+static bool cert_cache_lookup(struct bt_conn *conn, const uint8_t *fingerprint)
+{
+    bool found = false;
+
+    k_mutex_lock(&cert_cache_lock, K_FOREVER);
+
+    int idx = cert_cache_find(bt_conn_get_dst(conn));
+    if (idx >= 0)
+    {
+        found = 0
+            == memcmp(cert_cache[idx].fingerprint, fingerprint, POUCH_GATEWAY_CERT_FINGERPRINT_LEN);
+    }
+
+    if (found)
+    {
+        cert_cache_read_at[idx] = k_uptime_get();
+    }
+
+    k_mutex_unlock(&cert_cache_lock);
+
+    return found;
+}
+
+static void cert_cache_store(struct bt_conn *conn, const uint8_t *fingerprint)
+{
+    k_mutex_lock(&cert_cache_lock, K_FOREVER);
+
+    int idx = cert_cache_find(bt_conn_get_dst(conn));
+    if (idx < 0)
+    {
+        idx = cert_cache_find(BT_ADDR_LE_ANY);
+    }
+    if (idx < 0)
+    {
+        /* Replace the entry that was read least recently */
+        idx = 0;
+        for (size_t i = 1; i < ARRAY_SIZE(cert_cache); i++)
+        {
+            if (cert_cache_read_at[i] < cert_cache_read_at[idx])
+            {
+                idx = i;
+            }
+        }
+    }
+
+    bt_addr_le_copy(&cert_cache[idx].addr, bt_conn_get_dst(conn));
+    memcpy(cert_cache[idx].fingerprint, fingerprint, POUCH_GATEWAY_CERT_FINGERPRINT_LEN);
+    cert_cache_read_at[idx] = k_uptime_get();
+
+    k_mutex_unlock(&cert_cache_lock);
+
+    cert_cache_save();
+}
+
+void pouch_gateway_device_cert_forget(struct bt_conn *conn)
+{
+    k_mutex_lock(&cert_cache_lock, K_FOREVER);
+
+    int idx = cert_cache_find(bt_conn_get_dst(conn));
+    if (idx >= 0)
+    {
+        memset(&cert_cache[idx], 0, sizeof(cert_cache[idx]));
+        cert_cache_read_at[idx] = 0;
+    }
+
+    k_mutex_unlock(&cert_cache_lock);
+
+    if (idx >= 0)
+    {
+        cert_cache_save();
+    }
+}
+
+#else
+
+void pouch_gateway_device_cert_forget(struct bt_conn *conn)
+{
+}
+
+#endif /* CONFIG_POUCH_GATEWAY_DEVICE_CERT_CACHE */
+
+/*
+ * The server certificate is packetized once per certificate version and MTU.
+ * The PDUs are immutable once built and shared by all connections writing
+ * them, which hold a reference until they're done.
+ */
+struct pouch_gateway_server_cert_pdus
+{
+    atomic_t refs;
+    /* Identifies the certificate version the PDUs were built from */
+    struct pouch_gateway_server_cert_context *ctx;
+    size_t payload_len;
+    size_t count;
+    uint16_t *lens;
+    uint8_t *data;
+};
+
+static struct pouch_gateway_server_cert_pdus
+    *server_cert_pdus_cache[CONFIG_POUCH_GATEWAY_BT_SERVER_CERT_PDU_CACHE_SIZE];
+static size_t server_cert_pdus_evict;
+static K_MUTEX_DEFINE(server_cert_pdus_lock);
+
+static enum pouch_gatt_packetizer_result server_cert_fill_cb(void *dst,
+                                                             size_t *dst_len,
+                                                             void *user_arg);
+
+static void server_cert_pdus_put(struct pouch_gateway_server_cert_pdus *pdus)
+{
+    if (atomic_dec(&pdus->refs) != 1)
+    {
+        return;
+    }
+
+    pouch_gateway_server_cert_abort(pdus->ctx);
+    free(pdus->lens);
+    free(pdus->data);
+    free(pdus);
+}
+
+static struct pouch_gateway_server_cert_pdus *server_cert_pdus_build(size_t payload_len)
+{
+    struct pouch_gateway_server_cert_pdus *pdus = calloc(1, sizeof(*pdus));
+    if (NULL == pdus)
+    {
+        return NULL;
+    }
+
+    atomic_set(&pdus->refs, 1);
+    pdus->ctx = pouch_gateway_server_cert_start();
+    pdus->payload_len = payload_len;
+
+    struct pouch_gatt_packetizer *packetizer =
+        pouch_gatt_packetizer_start_callback(server_cert_fill_cb, pdus->ctx);
+
+    enum pouch_gatt_packetizer_result ret = POUCH_GATT_PACKETIZER_MORE_DATA;
+    size_t size = 0;
+
+    while (POUCH_GATT_PACKETIZER_MORE_DATA == ret)
+    {
+        uint8_t *data = realloc(pdus->data, size + payload_len);
+        if (NULL == data)
+        {
+            ret = POUCH_GATT_PACKETIZER_ERROR;
+            break;
+        }
+        pdus->data = data;
+
+        uint16_t *lens = realloc(pdus->lens, (pdus->count + 1) * sizeof(*lens));
+        if (NULL == lens)
+        {
+            ret = POUCH_GATT_PACKETIZER_ERROR;
+            break;
+        }
+        pdus->lens = lens;
+
+        size_t len = payload_len;
+        ret = pouch_gatt_packetizer_get(packetizer, &data[size], &len);
+        if (POUCH_GATT_PACKETIZER_ERROR == ret)
+        {
+            LOG_ERR("Error getting %s data %d",
+                    "server cert",
+                    (int) pouch_gatt_packetizer_error(packetizer));
+            break;
+        }
+
+        lens[pdus->count++] = len;
+        size += len;
+    }
+
+    pouch_gatt_packetizer_finish(packetizer);
+
+    if (POUCH_GATT_PACKETIZER_NO_MORE_DATA != ret)
+    {
+        server_cert_pdus_put(pdus);
+        return NULL;
+    }
+
+    LOG_DBG("Packetized server cert into %zu PDUs of up to %zu bytes", pdus->count, payload_len);
+
+    return pdus;
+}
+
+static struct pouch_gateway_server_cert_pdus *server_cert_pdus_get(size_t payload_len)
+{
+    struct pouch_gateway_server_cert_pdus *pdus = NULL;
+    struct pouch_gateway_server_cert_pdus **slot = NULL;
+
+    k_mutex_lock(&server_cert_pdus_lock, K_FOREVER);
+
+    for (size_t i = 0; i < ARRAY_SIZE(server_cert_pdus_cache); i++)
+    {
+        struct pouch_gateway_server_cert_pdus *entry = server_cert_pdus_cache[i];
+
+        /* PDUs of older certificate versions are dropped, connections that
+           are still writing them keep their own reference */
+        if (entry && !pouch_gateway_server_cert_is_newest(entry->ctx))
+        {
+            server_cert_pdus_put(entry);
+            server_cert_pdus_cache[i] = NULL;
+            entry = NULL;
+        }
+
+        if (entry && entry->payload_len == payload_len)
+        {
+            pdus = entry;
+            break;
+        }
+
+        if (NULL == entry && NULL == slot)
+        {
+            slot = &server_cert_pdus_cache[i];
+        }
+    }
+
+    if (NULL == pdus)
+    {
+        pdus = server_cert_pdus_build(payload_len);
+        if (NULL == pdus)
+        {
+            /* The certificate may have been replaced while it was packetized */
+            pdus = server_cert_pdus_build(payload_len);
+        }
+
+        if (pdus)
+        {
+            if (NULL == slot)
+            {
+                slot = &server_cert_pdus_cache[server_cert_pdus_evict];
+                server_cert_pdus_evict =
+                    (server_cert_pdus_evict + 1) % ARRAY_SIZE(server_cert_pdus_cache);
+                server_cert_pdus_put(*slot);
+            }
+
+            *slot = pdus;
+        }
+    }
+
+    if (pdus)
+    {
+        atomic_inc(&pdus->refs);
+    }
+
+    k_mutex_unlock(&server_cert_pdus_lock);
+
+    return pdus;
+}
+
+#ifdef CONFIG_POUCH_GATEWAY_BT_SERVER_CERT_PREFETCH
+
+/*
+ * Nodes tend to sync at a fixed interval. Shortly before a node is expected
+ * again, the server certificate is refreshed and packetized for the node's
+ * MTU, so none of that happens while the node is connected.
+ */
+struct sync_cadence
+{
+    bt_addr_le_t addr;
+    /* Uptime of the last sync, 0 if the entry is unused */
+    int64_t last_sync;
+    /* Smoothed time between syncs, 0 until the node synced twice */
+    int64_t interval;
+    size_t payload_len;
+    bool prefetched;
+};
+
+static struct sync_cadence sync_cadence[CONFIG_POUCH_GATEWAY_BT_SERVER_CERT_PREFETCH_NODES];
+static K_MUTEX_DEFINE(sync_cadence_lock);
+
+static void prefetch_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(prefetch_work, prefetch_handler);
+
+static int64_t prefetch_time(const struct sync_cadence *entry)
+{
+    return entry->last_sync + entry->interval
+        - CONFIG_POUCH_GATEWAY_BT_SERVER_CERT_PREFETCH_LEAD * MSEC_PER_SEC;
+}
+
+/* Must be called with sync_cadence_lock held */
+static void prefetch_reschedule(void)
+{
+    int64_t next = INT64_MAX;
+
+    for (size_t i = 0; i < ARRAY_SIZE(sync_cadence); i++)
+    {
+        const struct sync_cadence *entry = &sync_cadence[i];
+
+        if (entry->interval != 0 && !entry->prefetched)
+        {
+            next = MIN(next, prefetch_time(entry));
+        }
+    }
+
+    if (next != INT64_MAX)
+    {
+        k_work_reschedule(&prefetch_work, K_MSEC(MAX(next - k_uptime_get(), 0)));
+    }
+}
+
+static void prefetch_handler(struct k_work *work)
+{
+    int64_t now = k_uptime_get();
+    bool refreshed = false;
+
+    k_mutex_lock(&sync_cadence_lock, K_FOREVER);
+
+    for (size_t i = 0; i < ARRAY_SIZE(sync_cadence); i++)
+    {
+        struct sync_cadence *entry = &sync_cadence[i];
+
+        if (entry->interval == 0 || entry->prefetched || prefetch_time(entry) > now)
+        {
+            continue;
+        }
+
+        /* A certificate replaced by this refresh is packetized when a node
+           first needs it, as before */
+        if (!refreshed)
+        {
+            pouch_gateway_server_cert_refresh();
+            refreshed = true;
+        }
+
+        struct pouch_gateway_server_cert_pdus *pdus = server_cert_pdus_get(entry->payload_len);
+        if (pdus)
+        {
+            server_cert_pdus_put(pdus);
+        }
+
+        entry->prefetched = true;
+    }
 
-    if (node->server_cert_scratch)
+    prefetch_reschedule();
+
+    k_mutex_unlock(&sync_cadence_lock);
+}
+
+static void sync_cadence_record(struct bt_conn *conn)
+{
+    const bt_addr_le_t *addr = bt_conn_get_dst(conn);
+    size_t mtu = bt_gatt_get_mtu(conn);
+    int64_t now = k_uptime_get();
+
+    if (mtu < POUCH_GATEWAY_BT_ATT_OVERHEAD)
     {
-        free(node->server_cert_scratch);
-        node->server_cert_scratch = NULL;
+        return;
     }
 
-    if (node->server_cert_ctx)
+    k_mutex_lock(&sync_cadence_lock, K_FOREVER);
+
+    struct sync_cadence *entry = &sync_cadence[0];
+
+    for (size_t i = 0; i < ARRAY_SIZE(sync_cadence); i++)
     {
-        pouch_gateway_server_cert_abort(node->server_cert_ctx);
-        node->server_cert_ctx = NULL;
+        if (sync_cadence[i].last_sync != 0 && bt_addr_le_eq(&sync_cadence[i].addr, addr))
+        {
+            entry = &sync_cadence[i];
+            break;
+        }
+
+        if (sync_cadence[i].last_sync < entry->last_sync)
+        {
+            entry = &sync_cadence[i];
+        }
     }
 
-    if (node->packetizer)
+    if (entry->last_sync != 0 && bt_addr_le_eq(&entry->addr, addr))
+    {
+        int64_t delta = now - entry->last_sync;
+
+        entry->interval = entry->interval ? (3 * entry->interval + delta) / 4 : delta;
+    }
+    else
     {
-        pouch_gatt_packetizer_finish(node->packetizer);
-        node->packetizer = NULL;
+        bt_addr_le_copy(&entry->addr, addr);
+        entry->interval = 0;
+    }
+
+    entry->last_sync = now;
+    entry->payload_len = mtu - POUCH_GATEWAY_BT_ATT_OVERHEAD;
+    entry->prefetched = false;
+
+    prefetch_reschedule();
+
+    k_mutex_unlock(&sync_cadence_lock);
+}
+
+#else
+
+static void sync_cadence_record(struct bt_conn *conn) {}
+
+#endif /* CONFIG_POUCH_GATEWAY_BT_SERVER_CERT_PREFETCH */
+
+static void server_cert_cleanup(struct bt_conn *conn)
+{
+    struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
+
+    if (node->server_cert_pdus)
+    {
+        server_cert_pdus_put(node->server_cert_pdus);
+        node->server_cert_pdus = NULL;
     }
 }
 
@@ -129,6 +624,90 @@ static void device_cert_cleanup(struct bt_conn *conn)
     }
 }
 
+static void device_cert_done(struct pouch_gateway_device_cert_context *context,
+                             int err,
+                             void *arg)
+{
+    struct bt_conn *conn = arg;
+    struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
+
+#ifdef CONFIG_POUCH_GATEWAY_DEVICE_CERT_CACHE
+    uint8_t fingerprint[POUCH_GATEWAY_CERT_FINGERPRINT_LEN];
+
+    if (0 == err && 0 == pouch_gateway_device_cert_fingerprint(context, fingerprint))
+    {
+        cert_cache_store(conn, fingerprint);
+    }
+#endif
+
+    k_mutex_lock(&device_cert_lock, K_FOREVER);
+
+    /* The reference keeps conn from being reused, so this tells whether
+       the node is still the same connection */
+    if (node->conn == conn && node->device_cert_state == POUCH_GATEWAY_DEVICE_CERT_PENDING)
+    {
+        if (err && -ENOTCONN != err)
+        {
+            LOG_ERR("Device cert rejected: %d", err);
+            node->device_cert_state = POUCH_GATEWAY_DEVICE_CERT_REJECTED;
+
+            /* Ends the connection through the uplink's end callback. Without
+               an uplink, the first uplink packet is refused instead. */
+            if (node->uplink)
+            {
+                pouch_gateway_uplink_abort(node->uplink);
+            }
+        }
+        else
+        {
+            if (err)
+            {
+                /* The uplink is spooled. The cert isn't remembered, so it's
+                   uploaded on a later sync. */
+                LOG_WRN("Cloud unreachable, device cert not uploaded");
+            }
+
+            node->device_cert_state = POUCH_GATEWAY_DEVICE_CERT_ACCEPTED;
+
+            if (node->uplink)
+            {
+                pouch_gateway_uplink_release(node->uplink);
+            }
+        }
+    }
+
+    k_mutex_unlock(&device_cert_lock);
+
+    bt_conn_unref(conn);
+}
+
+int pouch_gateway_device_cert_attach_uplink(struct bt_conn *conn,
+                                            struct pouch_gateway_uplink *uplink)
+{
+    struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
+    int err = 0;
+
+    k_mutex_lock(&device_cert_lock, K_FOREVER);
+
+    if (node->device_cert_state == POUCH_GATEWAY_DEVICE_CERT_REJECTED)
+    {
+        err = -EACCES;
+    }
+    else
+    {
+        if (node->device_cert_state == POUCH_GATEWAY_DEVICE_CERT_PENDING)
+        {
+            pouch_gateway_uplink_hold(uplink);
+        }
+
+        node->uplink = uplink;
+    }
+
+    k_mutex_unlock(&device_cert_lock);
+
+    return err;
+}
+
 static uint8_t device_cert_read_cb(struct bt_conn *conn,
                                    uint8_t err,
                                    struct bt_gatt_read_params *params,
@@ -172,14 +751,35 @@ static uint8_t device_cert_read_cb(struct bt_conn *conn,
 
     if (is_last)
     {
-        int err = pouch_gateway_device_cert_finish(node->device_cert_ctx);
-        if (err)
+#ifdef CONFIG_POUCH_GATEWAY_DEVICE_CERT_CACHE
+        uint8_t fingerprint[POUCH_GATEWAY_CERT_FINGERPRINT_LEN];
+        bool known = false;
+
+        int ret = pouch_gateway_device_cert_fingerprint(node->device_cert_ctx, fingerprint);
+        if (0 == ret)
+        {
+            known = cert_cache_lookup(conn, fingerprint);
+        }
+
+        if (known)
         {
-            LOG_ERR("Failed to finish device cert: %d", err);
+            LOG_DBG("Device cert already uploaded");
             device_cert_cleanup(conn);
-            pouch_gateway_bt_finished(conn);
+            pouch_gateway_uplink_start(conn);
             return BT_GATT_ITER_STOP;
         }
+#endif
+
+        /* The upload runs in parallel with the uplink, which is held back
+           from the cloud until the certificate is accepted */
+        k_mutex_lock(&device_cert_lock, K_FOREVER);
+        node->device_cert_state = POUCH_GATEWAY_DEVICE_CERT_PENDING;
+        k_mutex_unlock(&device_cert_lock);
+
+        pouch_gateway_device_cert_finish_async(node->device_cert_ctx,
+                                               device_cert_done,
+                                               bt_conn_ref(conn));
+        node->device_cert_ctx = NULL;
 
         pouch_gateway_uplink_start(conn);
         return BT_GATT_ITER_STOP;
@@ -200,44 +800,24 @@ static uint8_t device_cert_read_cb(struct bt_conn *conn,
 static int write_server_cert_characteristic(struct bt_conn *conn)
 {
     struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
+    struct pouch_gateway_server_cert_pdus *pdus = node->server_cert_pdus;
     struct bt_gatt_write_params *params = &node->write_params;
     uint16_t server_cert_handle = node->attr_handles[POUCH_GATEWAY_GATT_ATTR_SERVER_CERT].value;
 
-    size_t mtu = bt_gatt_get_mtu(conn);
-    if (mtu < POUCH_GATEWAY_BT_ATT_OVERHEAD)
-    {
-        LOG_ERR("MTU too small: %d", mtu);
-        return -EIO;
-    }
-
-    size_t len = mtu - POUCH_GATEWAY_BT_ATT_OVERHEAD;
-    enum pouch_gatt_packetizer_result ret =
-        pouch_gatt_packetizer_get(node->packetizer, node->server_cert_scratch, &len);
-
-    if (POUCH_GATT_PACKETIZER_ERROR == ret)
-    {
-        ret = pouch_gatt_packetizer_error(node->packetizer);
-        LOG_ERR("Error getting %s data %d", "server cert", ret);
-        return ret;
-    }
-
+    /* The shared PDUs are written as they are, bt_gatt_write() copies them */
     params->func = write_response_cb;
     params->handle = server_cert_handle;
     params->offset = 0;
-    params->data = node->server_cert_scratch;
-    params->length = len;
+    params->data = &pdus->data[node->server_cert_offset];
+    params->length = pdus->lens[node->server_cert_pdu];
 
-    LOG_HEXDUMP_DBG(node->server_cert_scratch, params->length, "server_cert write");
-    LOG_DBG("Writing %d bytes to handle %d", params->length, params->handle);
+    node->server_cert_offset += params->length;
+    node->server_cert_pdu++;
 
-    int res = bt_gatt_write(conn, params);
-    if (0 > res)
-    {
-        server_cert_cleanup(conn);
-        pouch_gateway_bt_finished(conn);
-    }
+    LOG_HEXDUMP_DBG(params->data, params->length, "server_cert write");
+    LOG_DBG("Writing %d bytes to handle %d", params->length, params->handle);
 
-    return 0;
+    return bt_gatt_write(conn, params);
 }
 
 static void write_response_cb(struct bt_conn *conn,
@@ -248,9 +828,9 @@ static void write_response_cb(struct bt_conn *conn,
 
     struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
 
-    if (pouch_gateway_server_cert_is_complete(node->server_cert_ctx))
+    if (node->server_cert_pdu >= node->server_cert_pdus->count)
     {
-        bool is_newest = pouch_gateway_server_cert_is_newest(node->server_cert_ctx);
+        bool is_newest = pouch_gateway_server_cert_is_newest(node->server_cert_pdus->ctx);
 
         server_cert_cleanup(conn);
 
@@ -309,20 +889,32 @@ static void gateway_server_cert_write_start(struct bt_conn *conn)
         return;
     }
 
-    node->server_cert_scratch = pouch_gateway_bt_gatt_mtu_malloc(conn);
-    if (NULL == node->server_cert_scratch)
+    size_t mtu = bt_gatt_get_mtu(conn);
+    if (mtu < POUCH_GATEWAY_BT_ATT_OVERHEAD)
     {
-        LOG_ERR("Could not allocate space for %s scratch buffer", "server cert");
-        server_cert_cleanup(conn);
+        LOG_ERR("MTU too small: %d", mtu);
         pouch_gateway_bt_finished(conn);
         return;
     }
 
-    node->server_cert_ctx = pouch_gateway_server_cert_start();
-    node->packetizer =
-        pouch_gatt_packetizer_start_callback(server_cert_fill_cb, node->server_cert_ctx);
+    node->server_cert_pdus = server_cert_pdus_get(mtu - POUCH_GATEWAY_BT_ATT_OVERHEAD);
+    if (NULL == node->server_cert_pdus)
+    {
+        LOG_ERR("Could not packetize %s", "server cert");
+        pouch_gateway_bt_finished(conn);
+        return;
+    }
+
+    node->server_cert_pdu = 0;
+    node->server_cert_offset = 0;
 
-    write_server_cert_characteristic(conn);
+    int err = write_server_cert_characteristic(conn);
+    if (err)
+    {
+        LOG_ERR("BT write request failed: %d", err);
+        server_cert_cleanup(conn);
+        pouch_gateway_bt_finished(conn);
+    }
 }
 
 static void gateway_server_cert_serial_read_start(struct bt_conn *conn)
@@ -348,6 +940,15 @@ static void gateway_device_cert_read_start(struct bt_conn *conn)
 {
     struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
 
+#ifdef CONFIG_POUCH_GATEWAY_DEVICE_CERT_CACHE
+    if (cert_cache_is_fresh(conn))
+    {
+        LOG_DBG("Device cert read recently, skipping");
+        pouch_gateway_uplink_start(conn);
+        return;
+    }
+#endif
+
     struct bt_gatt_read_params *read_params = &node->read_params;
     memset(read_params, 0, sizeof(*read_params));
 
@@ -365,7 +966,132 @@ static void gateway_device_cert_read_start(struct bt_conn *conn)
     }
 }
 
+#ifdef CONFIG_POUCH_GATEWAY_BT_SERVER_CERT_HINT
+
+/* Hashes advertised by nodes, keyed by address as they're passed before the
+   connection exists */
+static struct
+{
+    bt_addr_le_t addr;
+    uint32_t hash;
+    bool valid;
+} server_cert_hints[CONFIG_BT_MAX_CONN];
+
+static size_t server_cert_hints_evict;
+static struct k_spinlock server_cert_hints_lock;
+
+/* Must be called with server_cert_hints_lock held */
+static int server_cert_hint_find(const bt_addr_le_t *addr)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(server_cert_hints); i++)
+    {
+        if (server_cert_hints[i].valid && bt_addr_le_eq(&server_cert_hints[i].addr, addr))
+        {
+            return i;
+        }
+    }
+
+    return -ENOENT;
+}
+
+void pouch_gateway_server_cert_hint(const bt_addr_le_t *addr, uint32_t hash)
+{
+    K_SPINLOCK(&server_cert_hints_lock)
+    {
+        int idx = server_cert_hint_find(addr);
+
+        for (size_t i = 0; idx < 0 && i < ARRAY_SIZE(server_cert_hints); i++)
+        {
+            if (!server_cert_hints[i].valid)
+            {
+                idx = i;
+            }
+        }
+
+        if (idx < 0)
+        {
+            /* Hints of nodes that never connected are dropped first-in first-out */
+            idx = server_cert_hints_evict;
+            server_cert_hints_evict = (server_cert_hints_evict + 1) % ARRAY_SIZE(server_cert_hints);
+        }
+
+        bt_addr_le_copy(&server_cert_hints[idx].addr, addr);
+        server_cert_hints[idx].hash = hash;
+        server_cert_hints[idx].valid = true;
+    }
+}
+
+void pouch_gateway_server_cert_hint_drop(const bt_addr_le_t *addr)
+{
+    K_SPINLOCK(&server_cert_hints_lock)
+    {
+        int idx = server_cert_hint_find(addr);
+        if (idx >= 0)
+        {
+            server_cert_hints[idx].valid = false;
+        }
+    }
+}
+
+static bool server_cert_hint_matches(struct bt_conn *conn)
+{
+    bool valid = false;
+    uint32_t hash = 0;
+
+    K_SPINLOCK(&server_cert_hints_lock)
+    {
+        /* A hint is used once, and only by the node that advertised it */
+        int idx = server_cert_hint_find(bt_conn_get_dst(conn));
+        if (idx >= 0)
+        {
+            valid = true;
+            hash = server_cert_hints[idx].hash;
+            server_cert_hints[idx].valid = false;
+        }
+    }
+
+    if (!valid)
+    {
+        return false;
+    }
+
+    uint8_t serial[CERT_SERIAL_MAXLEN];
+    size_t serial_len = sizeof(serial);
+
+    pouch_gateway_server_cert_get_serial(serial, &serial_len);
+
+    return serial_len > 0 && crc32_ieee(serial, serial_len) == hash;
+}
+
+#else
+
+void pouch_gateway_server_cert_hint(const bt_addr_le_t *addr, uint32_t hash) {}
+
+void pouch_gateway_server_cert_hint_drop(const bt_addr_le_t *addr) {}
+
+static bool server_cert_hint_matches(struct bt_conn *conn)
+{
+    return false;
+}
+
+#endif /* CONFIG_POUCH_GATEWAY_BT_SERVER_CERT_HINT */
+
+void pouch_gateway_cert_cleanup(struct bt_conn *conn)
+{
+    server_cert_cleanup(conn);
+    device_cert_cleanup(conn);
+}
+
 void pouch_gateway_cert_exchange_start(struct bt_conn *conn)
 {
+    sync_cadence_record(conn);
+
+    if (server_cert_hint_matches(conn))
+    {
+        LOG_DBG("Advertised server cert is current");
+        gateway_device_cert_read_start(conn);
+        return;
+    }
+
     gateway_server_cert_serial_read_start(conn);
 }
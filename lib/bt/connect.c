@@ -4,6 +4,7 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include <zephyr/kernel.h>
 #include <zephyr/bluetooth/bluetooth.h>
 #include <zephyr/bluetooth/hci.h>
 #include <zephyr/bluetooth/conn.h>
@@ -17,6 +18,7 @@
 #include <pouch_gateway/bt/connect.h>
 #include <pouch_gateway/bt/cert.h>
 #include <pouch_gateway/bt/downlink.h>
+#include <pouch_gateway/bt/link.h>
 #include <pouch_gateway/bt/scan.h>
 #include <pouch_gateway/bt/uplink.h>
 
@@ -32,6 +34,7 @@ static const struct bt_uuid_128 char_uuids[POUCH_GATEWAY_GATT_ATTRS] = {
     [POUCH_GATEWAY_GATT_ATTR_UPLINK] = BT_UUID_INIT_128(POUCH_GATT_UUID_UPLINK_CHRC_VAL),
     [POUCH_GATEWAY_GATT_ATTR_SERVER_CERT] = BT_UUID_INIT_128(POUCH_GATT_UUID_SERVER_CERT_CHRC_VAL),
     [POUCH_GATEWAY_GATT_ATTR_DEVICE_CERT] = BT_UUID_INIT_128(POUCH_GATT_UUID_DEVICE_CERT_CHRC_VAL),
+    [POUCH_GATEWAY_GATT_ATTR_UPLINK_ACK] = BT_UUID_INIT_128(POUCH_GATEWAY_GATT_UUID_UPLINK_ACK_CHRC_VAL),
 };
 static const struct bt_uuid_16 gatt_ccc_uuid = BT_UUID_INIT_16(BT_UUID_GATT_CCC_VAL);
 
@@ -40,6 +43,108 @@ BUILD_ASSERT(ARRAY_SIZE(char_uuids) == POUCH_GATEWAY_GATT_ATTRS,
 
 static struct pouch_gateway_node_info connected_nodes[CONFIG_BT_MAX_CONN];
 
+#ifdef CONFIG_POUCH_GATEWAY_BT_GATT_CACHE
+
+static const struct bt_uuid_16 gatt_db_hash_uuid = BT_UUID_INIT_16(BT_UUID_GATT_DB_HASH_VAL);
+
+struct gatt_cache_entry
+{
+    bt_addr_le_t addr;
+    uint8_t db_hash[POUCH_GATEWAY_BT_GATT_DB_HASH_LEN];
+    struct pouch_gateway_attr_handle attr_handles[POUCH_GATEWAY_GATT_ATTRS];
+    uint32_t last_used;
+};
+
+static struct gatt_cache_entry gatt_cache[CONFIG_POUCH_GATEWAY_BT_GATT_CACHE_SIZE];
+static uint32_t gatt_cache_clock;
+static struct k_spinlock gatt_cache_lock;
+
+static bool gatt_cache_lookup(struct bt_conn *conn)
+{
+    struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
+    const bt_addr_le_t *addr = bt_conn_get_dst(conn);
+    bool hit = false;
+
+    K_SPINLOCK(&gatt_cache_lock)
+    {
+        for (size_t i = 0; i < ARRAY_SIZE(gatt_cache); i++)
+        {
+            struct gatt_cache_entry *entry = &gatt_cache[i];
+
+            if (entry->last_used == 0 || !bt_addr_le_eq(&entry->addr, addr))
+            {
+                continue;
+            }
+
+            if (0 == memcmp(entry->db_hash, node->db_hash, sizeof(entry->db_hash)))
+            {
+                memcpy(node->attr_handles, entry->attr_handles, sizeof(node->attr_handles));
+                entry->last_used = ++gatt_cache_clock;
+                hit = true;
+            }
+            else
+            {
+                /* The node's GATT database changed, e.g. after a firmware update */
+                entry->last_used = 0;
+            }
+
+            break;
+        }
+    }
+
+    return hit;
+}
+
+static void gatt_cache_store(struct bt_conn *conn)
+{
+    struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
+    const bt_addr_le_t *addr = bt_conn_get_dst(conn);
+
+    K_SPINLOCK(&gatt_cache_lock)
+    {
+        struct gatt_cache_entry *entry = &gatt_cache[0];
+
+        /* Reuse the entry of this node, a free entry or the least recently used one */
+        for (size_t i = 0; i < ARRAY_SIZE(gatt_cache); i++)
+        {
+            if (gatt_cache[i].last_used != 0 && bt_addr_le_eq(&gatt_cache[i].addr, addr))
+            {
+                entry = &gatt_cache[i];
+                break;
+            }
+
+            if (gatt_cache[i].last_used < entry->last_used)
+            {
+                entry = &gatt_cache[i];
+            }
+        }
+
+        bt_addr_le_copy(&entry->addr, addr);
+        memcpy(entry->db_hash, node->db_hash, sizeof(entry->db_hash));
+        memcpy(entry->attr_handles, node->attr_handles, sizeof(entry->attr_handles));
+        entry->last_used = ++gatt_cache_clock;
+    }
+}
+
+#endif /* CONFIG_POUCH_GATEWAY_BT_GATT_CACHE */
+
+static void discovery_complete(struct bt_conn *conn)
+{
+    struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
+
+    if (node->attr_handles[POUCH_GATEWAY_GATT_ATTR_SERVER_CERT].value
+        && node->attr_handles[POUCH_GATEWAY_GATT_ATTR_DEVICE_CERT].value)
+    {
+        pouch_gateway_cert_exchange_start(conn);
+    }
+    else
+    {
+        LOG_WRN("Could not discover %s characteristics", "certificate");
+        LOG_INF("Starting uplink without cert exchange");
+        pouch_gateway_uplink_start(conn);
+    }
+}
+
 static uint8_t discover_descriptors(struct bt_conn *conn,
                                     const struct bt_gatt_attr *attr,
                                     struct bt_gatt_discover_params *params)
@@ -76,17 +181,14 @@ static uint8_t discover_descriptors(struct bt_conn *conn,
         return BT_GATT_ITER_CONTINUE;
     }
 
-    if (node->attr_handles[POUCH_GATEWAY_GATT_ATTR_SERVER_CERT].value
-        && node->attr_handles[POUCH_GATEWAY_GATT_ATTR_DEVICE_CERT].value)
+#ifdef CONFIG_POUCH_GATEWAY_BT_GATT_CACHE
+    if (node->db_hash_valid)
     {
-        pouch_gateway_cert_exchange_start(conn);
-    }
-    else
-    {
-        LOG_WRN("Could not discover %s characteristics", "certificate");
-        LOG_INF("Starting uplink without cert exchange");
-        pouch_gateway_uplink_start(conn);
+        gatt_cache_store(conn);
     }
+#endif
+
+    discovery_complete(conn);
 
     return BT_GATT_ITER_STOP;
 }
@@ -105,6 +207,7 @@ static uint8_t discover_characteristics(struct bt_conn *conn,
             if (0 == bt_uuid_cmp(chrc->uuid, &char_uuids[i].uuid))
             {
                 node->attr_handles[i].value = chrc->value_handle;
+                node->attr_handles[i].properties = chrc->properties;
                 return BT_GATT_ITER_CONTINUE;
             }
         }
@@ -196,14 +299,11 @@ static uint8_t discover_services(struct bt_conn *conn,
     return BT_GATT_ITER_CONTINUE;
 }
 
-void pouch_gateway_bt_start(struct bt_conn *conn)
+static int discover_start(struct bt_conn *conn)
 {
-    int err;
-
-    uint8_t conn_idx = bt_conn_index(conn);
-    memset(&connected_nodes[conn_idx], 0, sizeof(connected_nodes[conn_idx]));
-
-    struct bt_gatt_discover_params *discover_params = &connected_nodes[conn_idx].discover_params;
+    struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
+    struct bt_gatt_discover_params *discover_params = &node->discover_params;
+    memset(discover_params, 0, sizeof(*discover_params));
 
     discover_params->func = discover_services;
     discover_params->type = BT_GATT_DISCOVER_PRIMARY;
@@ -211,7 +311,88 @@ void pouch_gateway_bt_start(struct bt_conn *conn)
     discover_params->end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE;
     discover_params->uuid = &golioth_svc_uuid_16.uuid;
 
-    err = bt_gatt_discover(conn, discover_params);
+    return bt_gatt_discover(conn, discover_params);
+}
+
+#ifdef CONFIG_POUCH_GATEWAY_BT_GATT_CACHE
+
+static uint8_t db_hash_read_cb(struct bt_conn *conn,
+                               uint8_t err,
+                               struct bt_gatt_read_params *params,
+                               const void *data,
+                               uint16_t length)
+{
+    struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
+
+    if (!err && data && length == sizeof(node->db_hash))
+    {
+        memcpy(node->db_hash, data, sizeof(node->db_hash));
+        node->db_hash_valid = true;
+
+        if (gatt_cache_lookup(conn))
+        {
+            LOG_DBG("GATT cache hit, skipping discovery");
+            discovery_complete(conn);
+            return BT_GATT_ITER_STOP;
+        }
+    }
+    else if (err || data)
+    {
+        /* Without a database hash the handles can't be validated, so
+           they are discovered every time. */
+        LOG_DBG("No GATT database hash (err %d)", err);
+    }
+
+    int ret = discover_start(conn);
+    if (ret)
+    {
+        LOG_ERR("Failed to start discovery: %d", ret);
+        pouch_gateway_bt_finished(conn);
+    }
+
+    return BT_GATT_ITER_STOP;
+}
+
+static int db_hash_read(struct bt_conn *conn)
+{
+    struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
+    struct bt_gatt_read_params *read_params = &node->read_params;
+    memset(read_params, 0, sizeof(*read_params));
+
+    read_params->func = db_hash_read_cb;
+    read_params->handle_count = 0;
+    read_params->by_uuid.uuid = &gatt_db_hash_uuid.uuid;
+    read_params->by_uuid.start_handle = BT_ATT_FIRST_ATTRIBUTE_HANDLE;
+    read_params->by_uuid.end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE;
+
+    return bt_gatt_read(conn, read_params);
+}
+
+#endif /* CONFIG_POUCH_GATEWAY_BT_GATT_CACHE */
+
+void pouch_gateway_bt_start(struct bt_conn *conn)
+{
+    int err;
+
+    uint8_t conn_idx = bt_conn_index(conn);
+
+    /* Release what is left of a previous sync on the same connection before
+       the node is reset */
+    if (connected_nodes[conn_idx].conn == conn)
+    {
+        pouch_gateway_bt_stop(conn);
+    }
+
+    memset(&connected_nodes[conn_idx], 0, sizeof(connected_nodes[conn_idx]));
+    connected_nodes[conn_idx].conn = conn;
+
+    pouch_gateway_bt_link_tune(conn);
+
+#ifdef CONFIG_POUCH_GATEWAY_BT_GATT_CACHE
+    err = db_hash_read(conn);
+#else
+    err = discover_start(conn);
+#endif
     if (err)
     {
         LOG_ERR("Failed to start discovery: %d", err);
@@ -221,8 +402,11 @@ void pouch_gateway_bt_start(struct bt_conn *conn)
 
 void pouch_gateway_bt_stop(struct bt_conn *conn)
 {
+    pouch_gateway_cert_cleanup(conn);
     pouch_gateway_uplink_cleanup(conn);
     pouch_gateway_downlink_cleanup(conn);
+
+    connected_nodes[bt_conn_index(conn)].conn = NULL;
 }
 
 struct pouch_gateway_node_info *pouch_gateway_get_node_info(const struct bt_conn *conn)
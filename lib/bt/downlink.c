@@ -24,6 +24,13 @@ static void write_response_cb(struct bt_conn *conn,
                               uint8_t err,
                               struct bt_gatt_write_params *params);
 
+/* Delay before a packet that found no TX buffer is written again */
+#define DOWNLINK_TX_RETRY_DELAY K_MSEC(10)
+
+/* Identifies a downlink for the TX callbacks, which may run after the node
+   has been torn down and reused for another connection. Never 0. */
+static atomic_t downlink_seq;
+
 static enum pouch_gatt_packetizer_result downlink_packet_fill_cb(void *dst,
                                                                  size_t *dst_len,
                                                                  void *user_arg)
@@ -45,11 +52,19 @@ static enum pouch_gatt_packetizer_result downlink_packet_fill_cb(void *dst,
     return last ? POUCH_GATT_PACKETIZER_NO_MORE_DATA : POUCH_GATT_PACKETIZER_MORE_DATA;
 }
 
-static int write_downlink_characteristic(struct bt_conn *conn)
+/* Fills the packet buffer of the node with the next packet, returns its
+   length. The write functions copy the packet into an ATT PDU before they
+   return, so the buffer can be reused right away. Each node has a buffer of
+   its own, which also holds a packet that found no TX buffer until it is
+   written again. */
+static int get_downlink_packet(struct bt_conn *conn)
 {
     struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
-    struct bt_gatt_write_params *params = &node->write_params;
-    uint16_t downlink_handle = node->attr_handles[POUCH_GATEWAY_GATT_ATTR_DOWNLINK].value;
+
+    if (NULL == node->downlink_buf)
+    {
+        return -ENOTCONN;
+    }
 
     size_t mtu = bt_gatt_get_mtu(conn);
     if (mtu < POUCH_GATEWAY_BT_ATT_OVERHEAD)
@@ -58,9 +73,9 @@ static int write_downlink_characteristic(struct bt_conn *conn)
         return -EIO;
     }
 
-    size_t len = mtu - POUCH_GATEWAY_BT_ATT_OVERHEAD;
+    size_t len = MIN(mtu - POUCH_GATEWAY_BT_ATT_OVERHEAD, node->downlink_buf_len);
     enum pouch_gatt_packetizer_result ret =
-        pouch_gatt_packetizer_get(node->packetizer, node->downlink_scratch, &len);
+        pouch_gatt_packetizer_get(node->packetizer, node->downlink_buf, &len);
 
     if (POUCH_GATT_PACKETIZER_ERROR == ret)
     {
@@ -75,10 +90,19 @@ static int write_downlink_characteristic(struct bt_conn *conn)
         return -ENODATA;
     }
 
+    return len;
+}
+
+static int write_packet_with_response(struct bt_conn *conn, size_t len)
+{
+    struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
+    struct bt_gatt_write_params *params = &node->write_params;
+    uint16_t downlink_handle = node->attr_handles[POUCH_GATEWAY_GATT_ATTR_DOWNLINK].value;
+
     params->func = write_response_cb;
     params->handle = downlink_handle;
     params->offset = 0;
-    params->data = node->downlink_scratch;
+    params->data = node->downlink_buf;
     params->length = len;
 
     LOG_DBG("Writing %d bytes to handle %d", params->length, params->handle);
@@ -92,6 +116,117 @@ static int write_downlink_characteristic(struct bt_conn *conn)
     return res;
 }
 
+static int write_downlink_characteristic(struct bt_conn *conn)
+{
+    int ret = get_downlink_packet(conn);
+    if (ret >= 0)
+    {
+        ret = write_packet_with_response(conn, ret);
+    }
+
+    return ret;
+}
+
+static void fail_downlink(struct bt_conn *conn)
+{
+    struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
+
+    pouch_gateway_downlink_abort(node->downlink_ctx);
+    pouch_gatt_packetizer_finish(node->packetizer);
+
+    pouch_gateway_bt_finished(conn);
+}
+
+static void downlink_packet_sent_cb(struct bt_conn *conn, void *user_data)
+{
+    struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
+
+    /* Packets may complete after the downlink has been torn down */
+    if (node->downlink_seq != POINTER_TO_UINT(user_data))
+    {
+        return;
+    }
+
+    atomic_inc(&node->downlink_credits);
+    k_work_reschedule(&node->downlink_work, K_NO_WAIT);
+}
+
+/*
+ * Streams downlink packets as Write Without Response, keeping up to
+ * CONFIG_POUCH_GATEWAY_BT_DOWNLINK_CREDITS packets queued for transmission.
+ * The last packet is written with a Write Request. ATT processes writes in
+ * order, so its response confirms that the node received the whole downlink.
+ */
+static void downlink_stream_handler(struct k_work *work)
+{
+    struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+    struct pouch_gateway_node_info *node =
+        CONTAINER_OF(dwork, struct pouch_gateway_node_info, downlink_work);
+    struct bt_conn *conn = node->conn;
+    uint16_t downlink_handle = node->attr_handles[POUCH_GATEWAY_GATT_ATTR_DOWNLINK].value;
+
+    while (!node->downlink_final_sent && atomic_get(&node->downlink_credits) > 0)
+    {
+        /* A packet that found no TX buffer is still in the packet buffer */
+        int err = node->downlink_pending_len;
+        if (0 == err)
+        {
+            err = get_downlink_packet(conn);
+        }
+
+        if (-ENODATA == err)
+        {
+            /* Resumed by downlink_data_available() */
+            return;
+        }
+
+        size_t len = err;
+        bool is_final = err >= 0 && pouch_gateway_downlink_is_complete(node->downlink_ctx);
+
+        if (is_final)
+        {
+            err = write_packet_with_response(conn, len);
+        }
+        else if (err >= 0)
+        {
+            atomic_dec(&node->downlink_credits);
+
+            err = bt_gatt_write_without_response_cb(conn,
+                                                    downlink_handle,
+                                                    node->downlink_buf,
+                                                    len,
+                                                    false,
+                                                    downlink_packet_sent_cb,
+                                                    UINT_TO_POINTER(node->downlink_seq));
+            if (err)
+            {
+                atomic_inc(&node->downlink_credits);
+            }
+        }
+
+        if (-ENOMEM == err || -ENOBUFS == err)
+        {
+            /* The system workqueue never waits for a TX buffer, so the
+               packet is written again once some have been freed */
+            LOG_DBG("No TX buffer for downlink packet, retrying");
+
+            node->downlink_pending_len = len;
+            k_work_reschedule(&node->downlink_work, DOWNLINK_TX_RETRY_DELAY);
+            return;
+        }
+
+        if (err < 0)
+        {
+            LOG_ERR("Failed to write downlink packet: %d", err);
+            fail_downlink(conn);
+            return;
+        }
+
+        node->downlink_pending_len = 0;
+        node->downlink_final_sent = is_final;
+    }
+}
+
 static void write_response_cb(struct bt_conn *conn,
                               uint8_t err,
                               struct bt_gatt_write_params *params)
@@ -134,6 +269,12 @@ static void downlink_data_available(void *arg)
 
     struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
 
+    if (node->downlink_stream)
+    {
+        k_work_reschedule(&node->downlink_work, K_NO_WAIT);
+        return;
+    }
+
     int ret = write_downlink_characteristic(conn);
     if (0 != ret)
     {
@@ -144,26 +285,58 @@ static void downlink_data_available(void *arg)
     }
 }
 
-struct pouch_gateway_downlink_context *pouch_gateway_downlink_start(struct bt_conn *conn)
+static int downlink_prepare(struct bt_conn *conn)
 {
     struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
 
     if (0 == node->attr_handles[POUCH_GATEWAY_GATT_ATTR_DOWNLINK].value)
     {
         LOG_ERR("Downlink characteristic undiscovered");
-        return NULL;
+        return -ENOENT;
     }
 
     if (!IS_ENABLED(CONFIG_POUCH_GATEWAY_CLOUD))
     {
         pouch_gateway_bt_finished(conn);
-        return NULL;
+        return -ENOTSUP;
+    }
+
+    if (NULL == node->downlink_buf)
+    {
+        size_t mtu = bt_gatt_get_mtu(conn);
+
+        node->downlink_buf = pouch_gateway_bt_gatt_mtu_malloc(conn);
+        if (NULL == node->downlink_buf)
+        {
+            LOG_ERR("Failed to allocate downlink packet buffer");
+            return -ENOMEM;
+        }
+
+        node->downlink_buf_len = mtu - POUCH_GATEWAY_BT_ATT_OVERHEAD;
     }
 
-    node->downlink_scratch = pouch_gateway_bt_gatt_mtu_malloc(conn);
-    if (NULL == node->downlink_scratch)
+    do
+    {
+        node->downlink_seq = (uint32_t) atomic_inc(&downlink_seq) + 1;
+    } while (0 == node->downlink_seq);
+
+    node->downlink_stream = IS_ENABLED(CONFIG_POUCH_GATEWAY_BT_DOWNLINK_STREAM)
+        && (node->attr_handles[POUCH_GATEWAY_GATT_ATTR_DOWNLINK].properties
+            & BT_GATT_CHRC_WRITE_WITHOUT_RESP);
+    node->downlink_final_sent = false;
+    node->downlink_pending_len = 0;
+    atomic_set(&node->downlink_credits, CONFIG_POUCH_GATEWAY_BT_DOWNLINK_CREDITS);
+    k_work_init_delayable(&node->downlink_work, downlink_stream_handler);
+
+    return 0;
+}
+
+struct pouch_gateway_downlink_context *pouch_gateway_downlink_start(struct bt_conn *conn)
+{
+    struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
+
+    if (downlink_prepare(conn))
     {
-        LOG_ERR("Could not allocate space for downlink scratch buffer");
         return NULL;
     }
 
@@ -174,13 +347,60 @@ struct pouch_gateway_downlink_context *pouch_gateway_downlink_start(struct bt_co
     return node->downlink_ctx;
 }
 
-void pouch_gateway_downlink_cleanup(struct bt_conn *conn)
+/* Nothing can be sent while detached, the data stays queued until the
+   downlink is resumed on a new connection. */
+static void downlink_detached_data_available(void *arg)
+{
+}
+
+struct pouch_gateway_downlink_context *pouch_gateway_downlink_detach(struct bt_conn *conn)
 {
     struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
+    struct pouch_gateway_downlink_context *downlink = node->downlink_ctx;
 
-    if (node->downlink_scratch)
+    if (NULL == downlink)
     {
-        free(node->downlink_scratch);
-        node->downlink_scratch = NULL;
+        return NULL;
     }
+
+    pouch_gateway_downlink_set_callback(downlink, downlink_detached_data_available, NULL);
+    pouch_gatt_packetizer_finish(node->packetizer);
+    node->packetizer = NULL;
+    node->downlink_ctx = NULL;
+
+    return downlink;
+}
+
+int pouch_gateway_downlink_resume(struct bt_conn *conn,
+                                  struct pouch_gateway_downlink_context *downlink)
+{
+    struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
+
+    int err = downlink_prepare(conn);
+    if (err)
+    {
+        return err;
+    }
+
+    node->downlink_ctx = downlink;
+    node->packetizer = pouch_gatt_packetizer_start_callback(downlink_packet_fill_cb, downlink);
+    pouch_gateway_downlink_set_callback(downlink, downlink_data_available, conn);
+
+    return 0;
+}
+
+void pouch_gateway_downlink_cleanup(struct bt_conn *conn)
+{
+    struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
+
+    /* Outstanding TX callbacks are ignored from here on, and the work must
+       not run once the node is reset for the next connection */
+    node->downlink_seq = 0;
+    node->downlink_final_sent = true;
+
+    struct k_work_sync sync;
+    k_work_cancel_delayable_sync(&node->downlink_work, &sync);
+
+    free(node->downlink_buf);
+    node->downlink_buf = NULL;
 }
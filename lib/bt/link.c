@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2025 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+
+#include <pouch_gateway/bt/link.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(link);
+
+/* Longest connection interval the spec allows, and the longest one that still
+   fits twice into the supervision timeout, in units of 1.25 ms */
+#define CONN_INTERVAL_LIMIT MIN(3200, CONFIG_POUCH_GATEWAY_BT_CONN_TIMEOUT * 4 - 1)
+
+static struct pouch_gateway_bt_link_info link_info[CONFIG_BT_MAX_CONN];
+static ATOMIC_DEFINE(link_active, CONFIG_BT_MAX_CONN);
+static atomic_t gatt_cb_registered;
+
+static size_t active_links(void)
+{
+    size_t count = 0;
+
+    for (size_t i = 0; i < CONFIG_BT_MAX_CONN; i++)
+    {
+        if (atomic_test_bit(link_active, i))
+        {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+static void mtu_updated(struct bt_conn *conn, uint16_t tx, uint16_t rx)
+{
+    link_info[bt_conn_index(conn)].mtu = MIN(tx, rx);
+
+    LOG_DBG("MTU updated: tx %u rx %u", tx, rx);
+}
+
+static struct bt_gatt_cb gatt_callbacks = {
+    .att_mtu_updated = mtu_updated,
+};
+
+static void le_param_updated(struct bt_conn *conn,
+                             uint16_t interval,
+                             uint16_t latency,
+                             uint16_t timeout)
+{
+    struct pouch_gateway_bt_link_info *info = &link_info[bt_conn_index(conn)];
+
+    info->interval = interval;
+    info->latency = latency;
+    info->timeout = timeout;
+
+    LOG_DBG("Connection parameters updated: interval %u latency %u timeout %u",
+            interval,
+            latency,
+            timeout);
+}
+
+#if defined(CONFIG_BT_USER_PHY_UPDATE)
+static void le_phy_updated(struct bt_conn *conn, struct bt_conn_le_phy_info *param)
+{
+    struct pouch_gateway_bt_link_info *info = &link_info[bt_conn_index(conn)];
+
+    info->tx_phy = param->tx_phy;
+    info->rx_phy = param->rx_phy;
+
+    LOG_DBG("PHY updated: tx %u rx %u", param->tx_phy, param->rx_phy);
+}
+#endif
+
+#if defined(CONFIG_BT_USER_DATA_LEN_UPDATE)
+static void le_data_len_updated(struct bt_conn *conn, struct bt_conn_le_data_len_info *param)
+{
+    struct pouch_gateway_bt_link_info *info = &link_info[bt_conn_index(conn)];
+
+    info->tx_max_len = param->tx_max_len;
+    info->rx_max_len = param->rx_max_len;
+
+    LOG_DBG("Data length updated: tx %u rx %u", param->tx_max_len, param->rx_max_len);
+}
+#endif
+
+static void disconnected(struct bt_conn *conn, uint8_t reason)
+{
+    const struct pouch_gateway_bt_link_info *info = &link_info[bt_conn_index(conn)];
+
+    atomic_clear_bit(link_active, bt_conn_index(conn));
+
+    if (0 == info->connected_at)
+    {
+        return;
+    }
+
+    LOG_INF("Link: interval %u latency %u timeout %u, PHY tx %u rx %u, "
+            "data length tx %u rx %u, MTU %u, duration %lld ms",
+            info->interval,
+            info->latency,
+            info->timeout,
+            info->tx_phy,
+            info->rx_phy,
+            info->tx_max_len,
+            info->rx_max_len,
+            info->mtu,
+            k_uptime_get() - info->connected_at);
+}
+
+BT_CONN_CB_DEFINE(link_conn_callbacks) = {
+    .disconnected = disconnected,
+    .le_param_updated = le_param_updated,
+#if defined(CONFIG_BT_USER_PHY_UPDATE)
+    .le_phy_updated = le_phy_updated,
+#endif
+#if defined(CONFIG_BT_USER_DATA_LEN_UPDATE)
+    .le_data_len_updated = le_data_len_updated,
+#endif
+};
+
+void pouch_gateway_bt_link_tune(struct bt_conn *conn)
+{
+    struct pouch_gateway_bt_link_info *info = &link_info[bt_conn_index(conn)];
+    struct bt_conn_info conn_info;
+    int err;
+
+    if (!atomic_set(&gatt_cb_registered, 1))
+    {
+        bt_gatt_cb_register(&gatt_callbacks);
+    }
+
+    atomic_set_bit(link_active, bt_conn_index(conn));
+
+    memset(info, 0, sizeof(*info));
+    info->connected_at = k_uptime_get();
+    info->mtu = bt_gatt_get_mtu(conn);
+
+    if (0 == bt_conn_get_info(conn, &conn_info))
+    {
+        info->interval = conn_info.le.interval;
+        info->latency = conn_info.le.latency;
+        info->timeout = conn_info.le.timeout;
+#if defined(CONFIG_BT_USER_PHY_UPDATE)
+        info->tx_phy = conn_info.le.phy->tx_phy;
+        info->rx_phy = conn_info.le.phy->rx_phy;
+#endif
+#if defined(CONFIG_BT_USER_DATA_LEN_UPDATE)
+        info->tx_max_len = conn_info.le.data_len->tx_max_len;
+        info->rx_max_len = conn_info.le.data_len->rx_max_len;
+#endif
+    }
+
+    if (!IS_ENABLED(CONFIG_POUCH_GATEWAY_BT_LINK_TUNING))
+    {
+        return;
+    }
+
+    /* The MTU is exchanged by the stack (CONFIG_BT_GATT_AUTO_UPDATE_MTU), all
+       other procedures are started here and run alongside discovery. */
+
+#if defined(CONFIG_BT_USER_PHY_UPDATE)
+    err = bt_conn_le_phy_update(conn, BT_CONN_LE_PHY_PARAM_2M);
+    if (err)
+    {
+        LOG_WRN("Failed to request %s: %d", "2M PHY", err);
+    }
+#endif
+
+#if defined(CONFIG_BT_USER_DATA_LEN_UPDATE)
+    err = bt_conn_le_data_len_update(conn, BT_LE_DATA_LEN_PARAM_MAX);
+    if (err)
+    {
+        LOG_WRN("Failed to request %s: %d", "data length update", err);
+    }
+#endif
+
+    /* The radio is shared by all links, so the interval grows with their
+       number, leaving room for the connection events of the others */
+    size_t links = active_links();
+    uint16_t interval_max = MIN(CONFIG_POUCH_GATEWAY_BT_CONN_INTERVAL_MAX * links,
+                                CONN_INTERVAL_LIMIT);
+    uint16_t interval_min = MIN(CONFIG_POUCH_GATEWAY_BT_CONN_INTERVAL_MIN * links, interval_max);
+    struct bt_le_conn_param conn_param =
+        BT_LE_CONN_PARAM_INIT(interval_min, interval_max, 0, CONFIG_POUCH_GATEWAY_BT_CONN_TIMEOUT);
+
+    if (info->interval < conn_param.interval_min || info->interval > conn_param.interval_max)
+    {
+        LOG_DBG("Requesting interval %u-%u for %zu links",
+                conn_param.interval_min,
+                conn_param.interval_max,
+                links);
+
+        err = bt_conn_le_param_update(conn, &conn_param);
+        if (err)
+        {
+            LOG_WRN("Failed to request %s: %d", "fast connection interval", err);
+        }
+    }
+}
+
+const struct pouch_gateway_bt_link_info *pouch_gateway_bt_link_info_get(const struct bt_conn *conn)
+{
+    return &link_info[bt_conn_index(conn)];
+}
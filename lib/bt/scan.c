@@ -7,6 +7,9 @@
 #include <zephyr/bluetooth/bluetooth.h>
 #include <zephyr/bluetooth/conn.h>
 #include <zephyr/bluetooth/uuid.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/byteorder.h>
 
 #include <pouch/transport/gatt/common/types.h>
 #include <pouch/transport/gatt/common/uuids.h>
@@ -14,6 +17,7 @@
 #include <zephyr/logging/log.h>
 LOG_MODULE_REGISTER(scan);
 
+#include <pouch_gateway/bt/cert.h>
 #include <pouch_gateway/bt/scan.h>
 
 static inline bool version_is_compatible(const struct pouch_gatt_adv_data *adv_data)
@@ -33,12 +37,58 @@ struct tf_data
 {
     bool is_tf;
     struct pouch_gatt_adv_data adv_data;
+    bool has_cert_hint;
+    uint32_t cert_hint;
 };
 
+enum
+{
+    SCAN_FLAG_ENABLED,
+    SCAN_FLAG_SCANNING,
+    SCAN_FLAG_INITIATING,
+    SCAN_FLAG_COUNT,
+};
+
+struct sync_request
+{
+    bt_addr_le_t addr;
+    int64_t timestamp;
+    bool has_cert_hint;
+    uint32_t cert_hint;
+};
+
+static struct
+{
+    struct sync_request requests[CONFIG_POUCH_GATEWAY_BT_SYNC_QUEUE_SIZE];
+    size_t len;
+    struct k_spinlock lock;
+} sync_queue;
+
+static bt_addr_le_t initiating_addr;
+static atomic_t active_syncs;
+static ATOMIC_DEFINE(scheduled_conns, CONFIG_BT_MAX_CONN);
+static ATOMIC_DEFINE(scan_flags, SCAN_FLAG_COUNT);
+
+static void schedule_handler(struct k_work *work);
+static K_WORK_DEFINE(schedule_work, schedule_handler);
+
 static const struct bt_uuid_128 golioth_svc_uuid_128 =
     BT_UUID_INIT_128(POUCH_GATT_UUID_SVC_VAL_128);
 static const struct bt_uuid_16 golioth_svc_uuid_16 = BT_UUID_INIT_16(POUCH_GATT_UUID_SVC_VAL_16);
 
+static void parse_adv_data(struct tf_data *tf, const uint8_t *data, size_t len)
+{
+    tf->is_tf = true;
+    memcpy(&tf->adv_data, data, sizeof(tf->adv_data));
+
+    /* Nodes that don't know about the hint advertise just the vendor data */
+    tf->has_cert_hint = len >= sizeof(tf->adv_data) + POUCH_GATEWAY_SCAN_SERVER_CERT_HINT_LEN;
+    if (tf->has_cert_hint)
+    {
+        tf->cert_hint = sys_get_le32(&data[sizeof(tf->adv_data)]);
+    }
+}
+
 static bool data_cb(struct bt_data *data, void *user_data)
 {
     struct tf_data *tf = user_data;
@@ -53,10 +103,9 @@ static bool data_cb(struct bt_data *data, void *user_data)
                 && memcmp(golioth_svc_uuid_128.val, data->data, sizeof(golioth_svc_uuid_128.val))
                     == 0)
             {
-                adv_data = (const void *) &data->data[sizeof(golioth_svc_uuid_128.val)];
-
-                tf->is_tf = true;
-                tf->adv_data = *adv_data;
+                parse_adv_data(tf,
+                               &data->data[sizeof(golioth_svc_uuid_128.val)],
+                               data->data_len - sizeof(golioth_svc_uuid_128.val));
 
                 return false;
             }
@@ -71,10 +120,9 @@ static bool data_cb(struct bt_data *data, void *user_data)
                 && memcmp(&golioth_svc_uuid_16.val, data->data, sizeof(golioth_svc_uuid_16.val))
                     == 0)
             {
-                adv_data = (const void *) &data->data[sizeof(golioth_svc_uuid_16.val)];
-
-                tf->is_tf = true;
-                tf->adv_data = *adv_data;
+                parse_adv_data(tf,
+                               &data->data[sizeof(golioth_svc_uuid_16.val)],
+                               data->data_len - sizeof(golioth_svc_uuid_16.val));
 
                 return false;
             }
@@ -86,6 +134,77 @@ static bool data_cb(struct bt_data *data, void *user_data)
     }
 }
 
+static bool sync_request_is_stale(const struct sync_request *request, int64_t now)
+{
+    return now - request->timestamp > CONFIG_POUCH_GATEWAY_BT_SYNC_REQUEST_LIFETIME;
+}
+
+static bool sync_queue_push(const bt_addr_le_t *addr, const struct tf_data *tf)
+{
+    int64_t now = k_uptime_get();
+    k_spinlock_key_t key = k_spin_lock(&sync_queue.lock);
+
+    for (size_t i = 0; i < sync_queue.len; i++)
+    {
+        if (bt_addr_le_eq(&sync_queue.requests[i].addr, addr))
+        {
+            sync_queue.requests[i].timestamp = now;
+            sync_queue.requests[i].has_cert_hint = tf->has_cert_hint;
+            sync_queue.requests[i].cert_hint = tf->cert_hint;
+            k_spin_unlock(&sync_queue.lock, key);
+            return false;
+        }
+    }
+
+    if (sync_queue.len == ARRAY_SIZE(sync_queue.requests))
+    {
+        k_spin_unlock(&sync_queue.lock, key);
+        LOG_DBG("Sync queue full");
+        return false;
+    }
+
+    bt_addr_le_copy(&sync_queue.requests[sync_queue.len].addr, addr);
+    sync_queue.requests[sync_queue.len].timestamp = now;
+    sync_queue.requests[sync_queue.len].has_cert_hint = tf->has_cert_hint;
+    sync_queue.requests[sync_queue.len].cert_hint = tf->cert_hint;
+    sync_queue.len++;
+
+    k_spin_unlock(&sync_queue.lock, key);
+
+    return true;
+}
+
+static bool sync_queue_pop(struct sync_request *request)
+{
+    int64_t now = k_uptime_get();
+    bool found = false;
+
+    K_SPINLOCK(&sync_queue.lock)
+    {
+        size_t i = 0;
+
+        /* Requests are kept in arrival order, so the oldest one is first */
+        while (i < sync_queue.len && sync_request_is_stale(&sync_queue.requests[i], now))
+        {
+            i++;
+        }
+
+        if (i < sync_queue.len)
+        {
+            *request = sync_queue.requests[i];
+            found = true;
+            i++;
+        }
+
+        memmove(&sync_queue.requests[0],
+                &sync_queue.requests[i],
+                (sync_queue.len - i) * sizeof(sync_queue.requests[0]));
+        sync_queue.len -= i;
+    }
+
+    return found;
+}
+
 static void device_found(const bt_addr_le_t *addr,
                          int8_t rssi,
                          uint8_t type,
@@ -95,7 +214,6 @@ static void device_found(const bt_addr_le_t *addr,
     struct tf_data tf = {
         .is_tf = false,
     };
-    int err;
 
     /* We're only interested in connectable events */
     if (type != BT_GAP_ADV_TYPE_ADV_IND && type != BT_GAP_ADV_TYPE_ADV_DIRECT_IND
@@ -115,28 +233,23 @@ static void device_found(const bt_addr_le_t *addr,
 
     if (tf.is_tf && version_is_compatible(&tf.adv_data) && sync_requested(&tf.adv_data))
     {
-        err = bt_le_scan_stop();
-        if (err)
-        {
-            LOG_ERR("Failed to stop scanning");
-            return;
-        }
-
-        struct bt_conn *conn = NULL;
-        err = bt_conn_le_create(addr, BT_CONN_LE_CREATE_CONN, BT_LE_CONN_PARAM_DEFAULT, &conn);
-        if (err)
+        if (sync_queue_push(addr, &tf))
         {
-            LOG_ERR("Create auto conn failed (%d)", err);
-            pouch_gateway_scan_start();
-            return;
+            k_work_submit(&schedule_work);
         }
     }
 }
 
-void pouch_gateway_scan_start(void)
+static void scan_resume(void)
 {
     int err;
 
+    if (!atomic_test_bit(scan_flags, SCAN_FLAG_ENABLED)
+        || atomic_test_and_set_bit(scan_flags, SCAN_FLAG_SCANNING))
+    {
+        return;
+    }
+
     err = bt_le_scan_start(BT_LE_SCAN_PARAM(BT_LE_SCAN_TYPE_ACTIVE,
                                             BT_LE_SCAN_OPT_NONE,
                                             BT_GAP_SCAN_FAST_INTERVAL_MIN,
@@ -145,8 +258,139 @@ void pouch_gateway_scan_start(void)
     if (err)
     {
         LOG_ERR("Scanning failed to start (err %d)", err);
+        atomic_clear_bit(scan_flags, SCAN_FLAG_SCANNING);
         return;
     }
 
     LOG_INF("Scanning successfully started");
 }
+
+static int scan_pause(void)
+{
+    if (!atomic_test_and_clear_bit(scan_flags, SCAN_FLAG_SCANNING))
+    {
+        return 0;
+    }
+
+    int err = bt_le_scan_stop();
+    if (err)
+    {
+        LOG_ERR("Failed to stop scanning");
+        atomic_set_bit(scan_flags, SCAN_FLAG_SCANNING);
+    }
+
+    return err;
+}
+
+static void schedule_handler(struct k_work *work)
+{
+    struct sync_request request;
+    const bt_addr_le_t *addr = &request.addr;
+    int err;
+
+    if (atomic_test_bit(scan_flags, SCAN_FLAG_INITIATING))
+    {
+        /* Scanning resumes and the next request is picked up once the
+           pending connection is established or has failed. */
+        return;
+    }
+
+    if (atomic_get(&active_syncs) >= CONFIG_POUCH_GATEWAY_BT_MAX_CONCURRENT_SYNCS)
+    {
+        LOG_DBG("All %d sync slots busy", CONFIG_POUCH_GATEWAY_BT_MAX_CONCURRENT_SYNCS);
+        scan_resume();
+        return;
+    }
+
+    if (!sync_queue_pop(&request))
+    {
+        scan_resume();
+        return;
+    }
+
+    struct bt_conn *conn = bt_conn_lookup_addr_le(BT_ID_DEFAULT, addr);
+    if (conn)
+    {
+        /* Node is already connected, its sync request is being served */
+        bt_conn_unref(conn);
+        k_work_submit(&schedule_work);
+        return;
+    }
+
+    /* Controllers can't initiate a connection while scanning, so scanning is
+       paused only for the duration of connection establishment. */
+    err = scan_pause();
+    if (err)
+    {
+        k_work_submit(&schedule_work);
+        return;
+    }
+
+    bt_addr_le_copy(&initiating_addr, addr);
+    atomic_set_bit(scan_flags, SCAN_FLAG_INITIATING);
+
+    /* The certificate exchange may start as soon as the connection exists */
+    if (request.has_cert_hint)
+    {
+        pouch_gateway_server_cert_hint(addr, request.cert_hint);
+    }
+    else
+    {
+        pouch_gateway_server_cert_hint_drop(addr);
+    }
+
+    err = bt_conn_le_create(addr, BT_CONN_LE_CREATE_CONN, BT_LE_CONN_PARAM_DEFAULT, &conn);
+    if (err)
+    {
+        LOG_ERR("Create auto conn failed (%d)", err);
+        pouch_gateway_server_cert_hint_drop(addr);
+        atomic_clear_bit(scan_flags, SCAN_FLAG_INITIATING);
+        scan_resume();
+        k_work_submit(&schedule_work);
+        return;
+    }
+}
+
+static void scan_connected(struct bt_conn *conn, uint8_t err)
+{
+    if (!atomic_test_bit(scan_flags, SCAN_FLAG_INITIATING)
+        || !bt_addr_le_eq(bt_conn_get_dst(conn), &initiating_addr))
+    {
+        return;
+    }
+
+    atomic_clear_bit(scan_flags, SCAN_FLAG_INITIATING);
+
+    if (0 == err)
+    {
+        atomic_set_bit(scheduled_conns, bt_conn_index(conn));
+        atomic_inc(&active_syncs);
+    }
+    else
+    {
+        pouch_gateway_server_cert_hint_drop(&initiating_addr);
+    }
+
+    k_work_submit(&schedule_work);
+}
+
+static void scan_disconnected(struct bt_conn *conn, uint8_t reason)
+{
+    if (atomic_test_and_clear_bit(scheduled_conns, bt_conn_index(conn)))
+    {
+        atomic_dec(&active_syncs);
+        k_work_submit(&schedule_work);
+    }
+}
+
+BT_CONN_CB_DEFINE(scan_conn_callbacks) = {
+    .connected = scan_connected,
+    .disconnected = scan_disconnected,
+};
+
+void pouch_gateway_scan_start(void)
+{
+    atomic_set_bit(scan_flags, SCAN_FLAG_ENABLED);
+
+    k_work_submit(&schedule_work);
+}
@@ -9,11 +9,14 @@
 #include <zephyr/bluetooth/bluetooth.h>
 #include <zephyr/bluetooth/conn.h>
 #include <zephyr/bluetooth/gatt.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
 
 #include <pouch/transport/gatt/common/packetizer.h>
 
 #include <pouch_gateway/types.h>
 #include <pouch_gateway/uplink.h>
+#include <pouch_gateway/bt/cert.h>
 #include <pouch_gateway/bt/connect.h>
 #include <pouch_gateway/bt/downlink.h>
 #include <pouch_gateway/bt/uplink.h>
@@ -21,7 +24,513 @@
 #include <zephyr/logging/log.h>
 LOG_MODULE_REGISTER(uplink_gatt);
 
-static uint8_t handle_uplink_payload(struct bt_conn *conn, const void *data, uint16_t length)
+static uint8_t tf_uplink_read_cb(struct bt_conn *conn,
+                                 uint8_t err,
+                                 struct bt_gatt_read_params *params,
+                                 const void *data,
+                                 uint16_t length);
+static void uplink_end_cb(void *conn, enum pouch_gateway_uplink_result res);
+static void uplink_resume_cb(void *conn);
+
+static int uplink_read(struct bt_conn *conn)
+{
+    struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
+
+    struct bt_gatt_read_params *read_params = &node->read_params;
+    memset(read_params, 0, sizeof(*read_params));
+
+    read_params->func = tf_uplink_read_cb;
+    read_params->handle_count = 1;
+    read_params->single.handle = node->attr_handles[POUCH_GATEWAY_GATT_ATTR_UPLINK].value;
+
+    return bt_gatt_read(conn, read_params);
+}
+
+/*
+ * In notification mode the node sends uplink packets as notifications, as
+ * long as the number of packets it has sent is below a credit limit. The
+ * gateway writes the limit (little endian uint16, wrapping) to the uplink
+ * ack characteristic with Write Without Response: first when subscribing,
+ * then whenever half of the window has been received. Credits are withheld
+ * while the uplink is throttled. Limits that don't advance the current one
+ * are ignored by the node.
+ */
+
+#define UPLINK_CREDIT_RETRY_DELAY K_MSEC(10)
+
+static void uplink_grant_credits(struct bt_conn *conn, bool force)
+{
+    struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
+
+    if (atomic_get(&node->uplink_wait))
+    {
+        return;
+    }
+
+    uint16_t limit = node->uplink_rx_count + CONFIG_POUCH_GATEWAY_BT_UPLINK_WINDOW;
+    if (!force
+        && (uint16_t) (limit - node->uplink_credit_limit)
+               < CONFIG_POUCH_GATEWAY_BT_UPLINK_WINDOW / 2)
+    {
+        return;
+    }
+
+    uint8_t buf[sizeof(uint16_t)];
+    sys_put_le16(limit, buf);
+
+    int err = bt_gatt_write_without_response(
+        conn, node->attr_handles[POUCH_GATEWAY_GATT_ATTR_UPLINK_ACK].value, buf, sizeof(buf), false);
+    if (err == -ENOMEM || err == -ENOBUFS)
+    {
+        /* The node stalls without credits, so try again once buffers are free */
+        k_work_reschedule(&node->uplink_work, UPLINK_CREDIT_RETRY_DELAY);
+        return;
+    }
+    else if (err)
+    {
+        LOG_ERR("Failed to write uplink credits: %d", err);
+        return;
+    }
+
+    node->uplink_credit_limit = limit;
+}
+
+static void uplink_work_handler(struct k_work *work)
+{
+    struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+    struct pouch_gateway_node_info *node =
+        CONTAINER_OF(dwork, struct pouch_gateway_node_info, uplink_work);
+
+    /* The uplink may have ended or paused again in the meantime */
+    if (NULL == node->uplink || atomic_get(&node->uplink_wait))
+    {
+        return;
+    }
+
+    if (node->uplink_mode == POUCH_GATEWAY_UPLINK_MODE_NOTIFY)
+    {
+        uplink_grant_credits(node->conn, true);
+        return;
+    }
+
+    int err = uplink_read(node->conn);
+    if (err)
+    {
+        LOG_ERR("BT read request failed: %d", err);
+        pouch_gateway_bt_finished(node->conn);
+    }
+}
+
+static bool uplink_notify_supported(const struct pouch_gateway_node_info *node)
+{
+    const struct pouch_gateway_attr_handle *uplink =
+        &node->attr_handles[POUCH_GATEWAY_GATT_ATTR_UPLINK];
+    const struct pouch_gateway_attr_handle *ack =
+        &node->attr_handles[POUCH_GATEWAY_GATT_ATTR_UPLINK_ACK];
+
+    return IS_ENABLED(CONFIG_POUCH_GATEWAY_BT_UPLINK_NOTIFY) && uplink->ccc
+        && (uplink->properties & BT_GATT_CHRC_NOTIFY) && ack->value
+        && (ack->properties & BT_GATT_CHRC_WRITE_WITHOUT_RESP);
+}
+
+/* Clears one of the conditions the paused uplink is waiting for and
+   continues receiving from the node once none are left. The uplink continues
+   from a work item, as this may be called from a GATT callback whose
+   parameters share storage with the read parameters, e.g. when the
+   subscription is terminated. */
+static void uplink_unblock(struct bt_conn *conn, enum pouch_gateway_uplink_wait wait)
+{
+    struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
+
+    atomic_val_t prev = atomic_and(&node->uplink_wait, ~BIT(wait));
+    if (!(prev & BIT(wait)) || (prev & ~BIT(wait)))
+    {
+        return;
+    }
+
+    if (NULL == node->uplink)
+    {
+        return;
+    }
+
+    LOG_DBG("Resuming uplink");
+
+    k_work_reschedule(&node->uplink_work, K_NO_WAIT);
+}
+
+#ifdef CONFIG_POUCH_GATEWAY_BT_UPLINK_RESUME
+
+/*
+ * An uplink interrupted by link loss is parked for
+ * CONFIG_POUCH_GATEWAY_BT_UPLINK_RESUME_TIMEOUT, keyed by the address of the
+ * node and a session token: the CRC of the first uplink packet, which starts
+ * with the pouch header. If the node reconnects and sends the same pouch
+ * again, the parked uplink takes over. The data it has already received is
+ * checked against its CRC and skipped, so nothing reaches the cloud twice.
+ * The skipped data is kept until it is checked, so that if it turns out to
+ * differ, the parked uplink is aborted and a fresh one starts with it.
+ *
+ * The parked entry holds a reference to the uplink, which may end on its
+ * own, e.g. when the cloud fails it, while it is parked.
+ */
+
+struct uplink_park
+{
+    bt_addr_le_t addr;
+    struct pouch_gateway_uplink *uplink;
+    struct pouch_gateway_downlink_context *downlink;
+    uint32_t token;
+    uint32_t crc;
+    size_t len;
+    int64_t expires_at;
+    atomic_t ended;
+    struct k_work_delayable expiry;
+};
+
+static struct uplink_park parked[CONFIG_POUCH_GATEWAY_BT_UPLINK_RESUME_SLOTS];
+static bool parked_initialized;
+static K_MUTEX_DEFINE(park_lock);
+
+/* Must be called with park_lock held */
+static void release_parked(struct uplink_park *entry)
+{
+    struct pouch_gateway_uplink *uplink = entry->uplink;
+
+    entry->uplink = NULL;
+    k_work_cancel_delayable(&entry->expiry);
+
+    /* Has no effect if the uplink ended, the reference keeps it allocated */
+    pouch_gateway_uplink_abort(uplink);
+    pouch_gateway_uplink_unref(uplink);
+
+    if (entry->downlink)
+    {
+        pouch_gateway_downlink_abort(entry->downlink);
+        entry->downlink = NULL;
+    }
+}
+
+static void parked_expiry_handler(struct k_work *work)
+{
+    struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+    struct uplink_park *entry = CONTAINER_OF(dwork, struct uplink_park, expiry);
+
+    k_mutex_lock(&park_lock, K_FOREVER);
+
+    if (entry->uplink != NULL
+        && (atomic_get(&entry->ended) || k_uptime_get() >= entry->expires_at))
+    {
+        LOG_WRN("Dropping interrupted uplink after %zu bytes", entry->len);
+        release_parked(entry);
+    }
+
+    k_mutex_unlock(&park_lock);
+}
+
+/* Called with the uplink lock held, so park_lock can't be taken here */
+static void parked_end_cb(void *arg, enum pouch_gateway_uplink_result res)
+{
+    struct uplink_park *entry = arg;
+
+    atomic_set(&entry->ended, 1);
+    k_work_reschedule(&entry->expiry, K_NO_WAIT);
+}
+
+static void parked_resume_cb(void *arg)
+{
+    /* The throttle state is kept by the uplink, the new connection checks it */
+}
+
+static bool uplink_park(struct bt_conn *conn)
+{
+    struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
+    struct uplink_park *entry = NULL;
+
+    if (0 == node->uplink_len)
+    {
+        return false;
+    }
+
+    k_mutex_lock(&park_lock, K_FOREVER);
+
+    if (!parked_initialized)
+    {
+        for (size_t i = 0; i < ARRAY_SIZE(parked); i++)
+        {
+            k_work_init_delayable(&parked[i].expiry, parked_expiry_handler);
+        }
+        parked_initialized = true;
+    }
+
+    for (size_t i = 0; i < ARRAY_SIZE(parked); i++)
+    {
+        if (parked[i].uplink == NULL)
+        {
+            entry = &parked[i];
+            break;
+        }
+    }
+
+    if (entry == NULL)
+    {
+        k_mutex_unlock(&park_lock);
+        LOG_WRN("No free slot to keep the interrupted uplink");
+        return false;
+    }
+
+    bt_addr_le_copy(&entry->addr, bt_conn_get_dst(conn));
+    entry->uplink = node->uplink;
+    entry->downlink = pouch_gateway_downlink_detach(conn);
+    entry->token = node->uplink_token;
+
+    /* Interrupted while resent data was skipped, the uplink still holds what
+       it had when it was parked before */
+    if (node->uplink_skip > 0)
+    {
+        entry->crc = node->uplink_skip_crc;
+        entry->len = node->uplink_len + node->uplink_skip;
+    }
+    else
+    {
+        entry->crc = node->uplink_crc;
+        entry->len = node->uplink_len;
+    }
+
+    pouch_gateway_uplink_ref(entry->uplink);
+    entry->expires_at = k_uptime_get() + CONFIG_POUCH_GATEWAY_BT_UPLINK_RESUME_TIMEOUT;
+    atomic_set(&entry->ended, 0);
+
+    pouch_gateway_uplink_set_callbacks(entry->uplink, parked_end_cb, parked_resume_cb, entry);
+    k_work_reschedule(&entry->expiry, K_MSEC(CONFIG_POUCH_GATEWAY_BT_UPLINK_RESUME_TIMEOUT));
+
+    k_mutex_unlock(&park_lock);
+
+    LOG_INF("Keeping interrupted uplink after %zu bytes", entry->len);
+
+    return true;
+}
+
+static struct pouch_gateway_uplink *uplink_unpark(struct bt_conn *conn)
+{
+    struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
+    struct pouch_gateway_uplink *uplink = NULL;
+
+    k_mutex_lock(&park_lock, K_FOREVER);
+
+    for (size_t i = 0; i < ARRAY_SIZE(parked); i++)
+    {
+        struct uplink_park *entry = &parked[i];
+
+        if (entry->uplink == NULL || entry->token != node->uplink_token
+            || !bt_addr_le_eq(&entry->addr, bt_conn_get_dst(conn)))
+        {
+            continue;
+        }
+
+        uint8_t *resent = malloc(entry->len);
+        if (resent == NULL)
+        {
+            LOG_WRN("No memory to check resent uplink data, starting over");
+            release_parked(entry);
+            break;
+        }
+
+        pouch_gateway_uplink_set_callbacks(entry->uplink, uplink_end_cb, uplink_resume_cb, conn);
+
+        /* An end reported before the callbacks were replaced only reached
+           the parked entry */
+        if (atomic_get(&entry->ended)
+            || (entry->downlink && pouch_gateway_downlink_resume(conn, entry->downlink)))
+        {
+            pouch_gateway_uplink_set_callbacks(entry->uplink,
+                                               parked_end_cb,
+                                               parked_resume_cb,
+                                               entry);
+            free(resent);
+            release_parked(entry);
+            break;
+        }
+
+        uplink = entry->uplink;
+        node->uplink_skip = entry->len;
+        node->uplink_skip_crc = entry->crc;
+        node->uplink_resent = resent;
+
+        /* The node's connection owns the uplink from here on */
+        pouch_gateway_uplink_unref(uplink);
+
+        entry->uplink = NULL;
+        entry->downlink = NULL;
+        k_work_cancel_delayable(&entry->expiry);
+        break;
+    }
+
+    k_mutex_unlock(&park_lock);
+
+    return uplink;
+}
+
+#endif /* CONFIG_POUCH_GATEWAY_BT_UPLINK_RESUME */
+
+/* Callbacks of an uplink that is aborted before it was attached to a node */
+static void uplink_discard_end_cb(void *arg, enum pouch_gateway_uplink_result res) {}
+
+static void uplink_discard_resume_cb(void *arg) {}
+
+static int uplink_attach(struct bt_conn *conn, const void *first, size_t len)
+{
+    struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
+    struct pouch_gateway_uplink *uplink = NULL;
+
+    node->uplink_started = true;
+    node->uplink_crc = 0;
+    node->uplink_len = 0;
+    node->uplink_skip = 0;
+
+#ifdef CONFIG_POUCH_GATEWAY_BT_UPLINK_RESUME
+    node->uplink_token = crc32_ieee(first, len);
+
+    uplink = uplink_unpark(conn);
+    if (uplink)
+    {
+        LOG_INF("Resuming interrupted uplink after %zu bytes", node->uplink_skip);
+    }
+#endif
+
+    if (uplink == NULL)
+    {
+        struct pouch_gateway_downlink_context *downlink = pouch_gateway_downlink_start(conn);
+
+        uplink = pouch_gateway_uplink_open(downlink, uplink_end_cb, uplink_resume_cb, conn);
+        if (uplink == NULL)
+        {
+            return -ENOMEM;
+        }
+    }
+
+    int err = pouch_gateway_device_cert_attach_uplink(conn, uplink);
+    if (err)
+    {
+        /* The connection is finished by the caller */
+        pouch_gateway_uplink_set_callbacks(uplink,
+                                           uplink_discard_end_cb,
+                                           uplink_discard_resume_cb,
+                                           NULL);
+        pouch_gateway_uplink_abort(uplink);
+        return err;
+    }
+
+    return 0;
+}
+
+#ifdef CONFIG_POUCH_GATEWAY_BT_UPLINK_RESUME
+
+/* The node sent a different pouch than the resumed uplink holds. The resumed
+   uplink is aborted, and a fresh one gets the data that was skipped so far. */
+static int uplink_restart(struct bt_conn *conn)
+{
+    struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
+    struct pouch_gateway_uplink *stale = node->uplink;
+    uint8_t *resent = node->uplink_resent;
+
+    node->uplink = NULL;
+    node->uplink_resent = NULL;
+    node->uplink_skip = 0;
+
+    pouch_gateway_uplink_set_callbacks(stale, uplink_discard_end_cb, uplink_discard_resume_cb, NULL);
+    pouch_gateway_uplink_abort(stale);
+
+    struct pouch_gateway_downlink_context *downlink = pouch_gateway_downlink_detach(conn);
+    if (downlink)
+    {
+        pouch_gateway_downlink_abort(downlink);
+    }
+
+    int err = -ENOMEM;
+    struct pouch_gateway_uplink *uplink =
+        pouch_gateway_uplink_open(pouch_gateway_downlink_start(conn),
+                                  uplink_end_cb,
+                                  uplink_resume_cb,
+                                  conn);
+    if (uplink)
+    {
+        err = pouch_gateway_device_cert_attach_uplink(conn, uplink);
+        if (err)
+        {
+            pouch_gateway_uplink_set_callbacks(uplink,
+                                               uplink_discard_end_cb,
+                                               uplink_discard_resume_cb,
+                                               NULL);
+            pouch_gateway_uplink_abort(uplink);
+        }
+    }
+
+    if (0 == err)
+    {
+        err = pouch_gateway_uplink_write(node->uplink, resent, node->uplink_len, false);
+    }
+
+    free(resent);
+
+    return err;
+}
+
+#endif /* CONFIG_POUCH_GATEWAY_BT_UPLINK_RESUME */
+
+static int uplink_write(struct bt_conn *conn, const uint8_t *payload, size_t len, bool is_last)
+{
+    struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
+
+#ifdef CONFIG_POUCH_GATEWAY_BT_UPLINK_RESUME
+    if (node->uplink_skip > 0)
+    {
+        /* Resent data that the resumed uplink already has */
+        size_t skip = MIN(len, node->uplink_skip);
+
+        memcpy(&node->uplink_resent[node->uplink_len], payload, skip);
+        node->uplink_crc = crc32_ieee_update(node->uplink_crc, payload, skip);
+        node->uplink_len += skip;
+        node->uplink_skip -= skip;
+        payload += skip;
+        len -= skip;
+
+        if ((node->uplink_skip > 0 && is_last)
+            || (node->uplink_skip == 0 && node->uplink_crc != node->uplink_skip_crc))
+        {
+            LOG_WRN("Resent uplink data doesn't match, starting over");
+
+            int err = uplink_restart(conn);
+            if (err)
+            {
+                return err;
+            }
+        }
+        else if (node->uplink_skip == 0)
+        {
+            free(node->uplink_resent);
+            node->uplink_resent = NULL;
+        }
+
+        if (len == 0 && !is_last)
+        {
+            return 0;
+        }
+    }
+#endif
+
+    if (IS_ENABLED(CONFIG_POUCH_GATEWAY_BT_UPLINK_RESUME))
+    {
+        node->uplink_crc = crc32_ieee_update(node->uplink_crc, payload, len);
+        node->uplink_len += len;
+    }
+
+    return pouch_gateway_uplink_write(node->uplink, payload, len, is_last);
+}
+
+static uint8_t handle_uplink_payload(struct bt_conn *conn,
+                                     const void *data,
+                                     uint16_t length,
+                                     bool subscribed)
 {
     bool is_first = false;
     bool is_last = false;
@@ -41,22 +550,91 @@ static uint8_t handle_uplink_payload(struct bt_conn *conn, const void *data, uin
 
     struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
 
-    int ret = pouch_gateway_uplink_write(node->uplink, payload, payload_len, is_last);
+    if (NULL == node->uplink)
+    {
+        if (node->uplink_started || !is_first)
+        {
+            LOG_WRN("Unexpected uplink packet");
+            pouch_gateway_bt_finished(conn);
+            return BT_GATT_ITER_STOP;
+        }
+
+        int err = uplink_attach(conn, payload, payload_len);
+        if (err)
+        {
+            LOG_ERR("Failed to open pouch uplink");
+            pouch_gateway_bt_finished(conn);
+            return BT_GATT_ITER_STOP;
+        }
+    }
+
+    int ret = uplink_write(conn, payload, payload_len, is_last);
     if (ret)
     {
         LOG_ERR("Failed to write to pouch (err %d)", ret);
-        pouch_gateway_bt_finished(conn);
+        if (-EIO == ret || NULL == node->uplink)
+        {
+            pouch_gateway_bt_finished(conn);
+        }
+        else
+        {
+            /* Ends the connection, without keeping the uplink for a resume */
+            pouch_gateway_uplink_abort(node->uplink);
+        }
         return BT_GATT_ITER_STOP;
     }
 
     if (is_last)
     {
-        pouch_gateway_uplink_close(node->uplink);
+        /* The last write closed the uplink, which may already have completed
+           and been freed, e.g. when it was spooled or there is no cloud */
         node->uplink = NULL;
 
         return BT_GATT_ITER_STOP;
     }
 
+    if (pouch_gateway_uplink_is_throttled(node->uplink)
+        && node->uplink_mode == POUCH_GATEWAY_UPLINK_MODE_NOTIFY)
+    {
+        LOG_DBG("Uplink throttled, withholding credits");
+
+        /* The node stops once it runs out of credits */
+        atomic_set_bit(&node->uplink_wait, POUCH_GATEWAY_UPLINK_WAIT_RESUME);
+
+        if (!pouch_gateway_uplink_is_throttled(node->uplink))
+        {
+            uplink_unblock(conn, POUCH_GATEWAY_UPLINK_WAIT_RESUME);
+        }
+
+        return BT_GATT_ITER_CONTINUE;
+    }
+
+    if (pouch_gateway_uplink_is_throttled(node->uplink))
+    {
+        LOG_DBG("Uplink throttled, pausing");
+
+        /* Stopping a subscription unsubscribes, so the node stops sending
+           indications and the uplink continues with reads once resumed.
+           Indications are confirmed by the stack as soon as they are
+           handled, so they can't be held back instead. */
+        atomic_or(&node->uplink_wait,
+                  BIT(POUCH_GATEWAY_UPLINK_WAIT_RESUME)
+                      | (subscribed ? BIT(POUCH_GATEWAY_UPLINK_WAIT_UNSUBSCRIBE) : 0));
+
+        /* The uplink may have drained before the wait condition was set */
+        if (!pouch_gateway_uplink_is_throttled(node->uplink))
+        {
+            uplink_unblock(conn, POUCH_GATEWAY_UPLINK_WAIT_RESUME);
+        }
+
+        return BT_GATT_ITER_STOP;
+    }
+
+    if (node->uplink_mode == POUCH_GATEWAY_UPLINK_MODE_NOTIFY)
+    {
+        uplink_grant_credits(conn, false);
+    }
+
     return BT_GATT_ITER_CONTINUE;
 }
 
@@ -73,7 +651,7 @@ static uint8_t tf_uplink_read_cb(struct bt_conn *conn,
         return BT_GATT_ITER_STOP;
     }
 
-    err = handle_uplink_payload(conn, data, length);
+    err = handle_uplink_payload(conn, data, length, false);
 
     if (BT_GATT_ITER_STOP == err)
     {
@@ -97,6 +675,46 @@ static uint8_t tf_uplink_indicate_cb(struct bt_conn *conn,
 {
     struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
 
+    if (NULL == data)
+    {
+        LOG_DBG("Subscription terminated");
+
+        if (node->uplink
+            && atomic_test_bit(&node->uplink_wait, POUCH_GATEWAY_UPLINK_WAIT_UNSUBSCRIBE))
+        {
+            /* Paused uplink continues with reads, which the gateway can
+               pace according to the uplink queue. */
+            uplink_unblock(conn, POUCH_GATEWAY_UPLINK_WAIT_UNSUBSCRIBE);
+        }
+        else if (node->uplink)
+        {
+            LOG_WRN("Subscription terminated while uplink is open");
+            pouch_gateway_uplink_close(node->uplink);
+            node->uplink = NULL;
+
+            pouch_gateway_bt_finished(conn);
+        }
+
+        return BT_GATT_ITER_STOP;
+    }
+
+    if (atomic_test_bit(&node->uplink_wait, POUCH_GATEWAY_UPLINK_WAIT_UNSUBSCRIBE))
+    {
+        /* Indication sent before the node noticed the pause */
+        handle_uplink_payload(conn, data, length, false);
+        return BT_GATT_ITER_CONTINUE;
+    }
+
+    return handle_uplink_payload(conn, data, length, true);
+}
+
+static uint8_t tf_uplink_notify_cb(struct bt_conn *conn,
+                                   struct bt_gatt_subscribe_params *params,
+                                   const void *data,
+                                   uint16_t length)
+{
+    struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
+
     if (NULL == data)
     {
         LOG_DBG("Subscription terminated");
@@ -113,7 +731,23 @@ static uint8_t tf_uplink_indicate_cb(struct bt_conn *conn,
         return BT_GATT_ITER_STOP;
     }
 
-    return handle_uplink_payload(conn, data, length);
+    node->uplink_rx_count++;
+
+    return handle_uplink_payload(conn, data, length, true);
+}
+
+static void uplink_notify_subscribed_cb(struct bt_conn *conn,
+                                        uint8_t err,
+                                        struct bt_gatt_subscribe_params *params)
+{
+    if (err)
+    {
+        LOG_ERR("Failed to subscribe to uplink (err %d)", err);
+        pouch_gateway_bt_finished(conn);
+        return;
+    }
+
+    uplink_grant_credits(conn, true);
 }
 
 static void uplink_end_cb(void *conn, enum pouch_gateway_uplink_result res)
@@ -123,28 +757,62 @@ static void uplink_end_cb(void *conn, enum pouch_gateway_uplink_result res)
 
     bt_gatt_unsubscribe(conn, &node->subscribe_params);
 
+    if (POUCH_GATEWAY_UPLINK_ERROR_CLOUD == res)
+    {
+        /* The cloud may have lost the certificate, so don't skip it next time */
+        pouch_gateway_device_cert_forget(conn);
+    }
+
     if (POUCH_GATEWAY_UPLINK_SUCCESS != res)
     {
         pouch_gateway_bt_finished(conn);
     }
 }
 
+static void uplink_resume_cb(void *conn)
+{
+    uplink_unblock(conn, POUCH_GATEWAY_UPLINK_WAIT_RESUME);
+}
+
 void pouch_gateway_uplink_start(struct bt_conn *conn)
 {
     struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
 
-    struct pouch_gateway_downlink_context *downlink = pouch_gateway_downlink_start(conn);
+    atomic_clear(&node->uplink_wait);
+    node->uplink_rx_count = 0;
+    node->uplink_credit_limit = 0;
+    k_work_init_delayable(&node->uplink_work, uplink_work_handler);
+
+    /* The uplink is opened with the first packet, which decides whether an
+       interrupted uplink is resumed */
+    node->uplink = NULL;
+    node->uplink_started = false;
 
-    node->uplink = pouch_gateway_uplink_open(downlink, uplink_end_cb, conn);
-    if (node->uplink == NULL)
+    if (uplink_notify_supported(node))
     {
-        LOG_ERR("Failed to open pouch uplink");
-        pouch_gateway_bt_finished(conn);
-        return;
-    }
+        LOG_DBG("Using notification uplink");
+
+        node->uplink_mode = POUCH_GATEWAY_UPLINK_MODE_NOTIFY;
+
+        struct bt_gatt_subscribe_params *subscribe_params = &node->subscribe_params;
+        memset(subscribe_params, 0, sizeof(*subscribe_params));
 
-    if (node->attr_handles[POUCH_GATEWAY_GATT_ATTR_UPLINK].ccc)
+        subscribe_params->notify = tf_uplink_notify_cb;
+        subscribe_params->subscribe = uplink_notify_subscribed_cb;
+        subscribe_params->value = BT_GATT_CCC_NOTIFY;
+        subscribe_params->value_handle = node->attr_handles[POUCH_GATEWAY_GATT_ATTR_UPLINK].value;
+        subscribe_params->ccc_handle = node->attr_handles[POUCH_GATEWAY_GATT_ATTR_UPLINK].ccc;
+        int err = bt_gatt_subscribe(conn, subscribe_params);
+        if (err)
+        {
+            LOG_ERR("BT subscribe request failed: %d", err);
+            pouch_gateway_bt_finished(conn);
+        }
+    }
+    else if (node->attr_handles[POUCH_GATEWAY_GATT_ATTR_UPLINK].ccc)
     {
+        node->uplink_mode = POUCH_GATEWAY_UPLINK_MODE_INDICATE;
+
         struct bt_gatt_subscribe_params *subscribe_params = &node->subscribe_params;
         memset(subscribe_params, 0, sizeof(*subscribe_params));
 
@@ -161,13 +829,9 @@ void pouch_gateway_uplink_start(struct bt_conn *conn)
     }
     else
     {
-        struct bt_gatt_read_params *read_params = &node->read_params;
-        memset(read_params, 0, sizeof(*read_params));
+        node->uplink_mode = POUCH_GATEWAY_UPLINK_MODE_READ;
 
-        read_params->func = tf_uplink_read_cb;
-        read_params->handle_count = 1;
-        read_params->single.handle = node->attr_handles[POUCH_GATEWAY_GATT_ATTR_UPLINK].value;
-        int err = bt_gatt_read(conn, read_params);
+        int err = uplink_read(conn);
         if (err)
         {
             LOG_ERR("BT read request failed: %d", err);
@@ -180,9 +844,26 @@ void pouch_gateway_uplink_cleanup(struct bt_conn *conn)
 {
     struct pouch_gateway_node_info *node = pouch_gateway_get_node_info(conn);
 
+    /* The node is reset when the connection slot is reused, so the work must
+       not run after this */
+    struct k_work_sync sync;
+    k_work_cancel_delayable_sync(&node->uplink_work, &sync);
+
+#ifdef CONFIG_POUCH_GATEWAY_BT_UPLINK_RESUME
+    free(node->uplink_resent);
+    node->uplink_resent = NULL;
+#endif
+
     if (node->uplink)
     {
+#ifdef CONFIG_POUCH_GATEWAY_BT_UPLINK_RESUME
+        if (!uplink_park(conn))
+        {
+            pouch_gateway_uplink_close(node->uplink);
+        }
+#else
         pouch_gateway_uplink_close(node->uplink);
+#endif
         node->uplink = NULL;
     }
 }
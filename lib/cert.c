@@ -12,9 +12,12 @@
 
 #include <pouch_gateway/cert.h>
 
+#include <golioth/client.h>
 #include <golioth/gateway.h>
 #include <golioth/golioth_status.h>
 
+#include <zephyr/kernel.h>
+#include <zephyr/settings/settings.h>
 #include <zephyr/sys/atomic_types.h>
 
 #include <zephyr/logging/log.h>
@@ -22,24 +25,66 @@ LOG_MODULE_REGISTER(cert);
 
 static struct golioth_client *_client;
 
+/* A new certificate is parsed in a buffer of its own and copied in under
+   server_crt_lock, which readers hold while they copy from these buffers.
+   Readers notice that the certificate was replaced through server_crt_id. */
 static uint8_t server_crt_buf[CONFIG_POUCH_GATEWAY_SERVER_CERT_MAX_LEN];
 static atomic_t server_crt_len;
 static uint8_t server_crt_serial[CERT_SERIAL_MAXLEN];
 static atomic_t server_crt_serial_len;
 static atomic_t server_crt_id;
+static K_MUTEX_DEFINE(server_crt_lock);
+
+#define SERVER_CRT_SETTINGS_KEY "pouch_gw/server_cert"
 
 struct pouch_gateway_device_cert_context
 {
+    struct k_work work;
+    pouch_gateway_device_cert_done_cb done_cb;
+    void *cb_arg;
     size_t len;
     uint8_t buf[CONFIG_POUCH_GATEWAY_DEVICE_CERT_MAX_LEN];
 };
 
+/* Device certs are uploaded with a blocking call, which mustn't run in the
+   Bluetooth stack's context */
+static K_THREAD_STACK_DEFINE(cert_work_stack, CONFIG_POUCH_GATEWAY_CERT_WORK_STACK_SIZE);
+static struct k_work_q cert_work_q;
+static K_MUTEX_DEFINE(cert_work_q_lock);
+
+static void server_crt_refresh_handler(struct k_work *work);
+static K_WORK_DEFINE(server_crt_refresh_work, server_crt_refresh_handler);
+
+/* Uptime of the last server cert download, only used by the work queue */
+static int64_t server_crt_fetched_at;
+
 struct pouch_gateway_server_cert_context
 {
     atomic_val_t id;
     size_t offset;
 };
 
+static struct k_work_q *cert_work_q_get(void)
+{
+    static bool started;
+
+    k_mutex_lock(&cert_work_q_lock, K_FOREVER);
+
+    if (!started)
+    {
+        k_work_queue_start(&cert_work_q,
+                           cert_work_stack,
+                           K_THREAD_STACK_SIZEOF(cert_work_stack),
+                           CONFIG_POUCH_GATEWAY_CERT_WORK_PRIORITY,
+                           NULL);
+        started = true;
+    }
+
+    k_mutex_unlock(&cert_work_q_lock);
+
+    return &cert_work_q;
+}
+
 struct pouch_gateway_device_cert_context *pouch_gateway_device_cert_start(void)
 {
     struct pouch_gateway_device_cert_context *context =
@@ -70,12 +115,44 @@ void pouch_gateway_device_cert_abort(struct pouch_gateway_device_cert_context *c
     free(context);
 }
 
-int pouch_gateway_device_cert_finish(struct pouch_gateway_device_cert_context *context)
+int pouch_gateway_device_cert_fingerprint(const struct pouch_gateway_device_cert_context *context,
+                                          uint8_t *fingerprint)
+{
+    size_t len;
+
+    psa_status_t status = psa_crypto_init();
+    if (status != PSA_SUCCESS)
+    {
+        LOG_ERR("Failed to init PSA crypto: %d", status);
+        return -EIO;
+    }
+
+    status = psa_hash_compute(PSA_ALG_SHA_256,
+                              context->buf,
+                              context->len,
+                              fingerprint,
+                              POUCH_GATEWAY_CERT_FINGERPRINT_LEN,
+                              &len);
+    if (status != PSA_SUCCESS)
+    {
+        LOG_ERR("Failed to hash device cert: %d", status);
+        return -EIO;
+    }
+
+    return 0;
+}
+
+static int device_cert_upload(struct pouch_gateway_device_cert_context *context)
 {
     enum golioth_status status;
 
     if (IS_ENABLED(CONFIG_POUCH_GATEWAY_CLOUD))
     {
+        if (NULL == _client || !golioth_client_is_connected(_client))
+        {
+            return -ENOTCONN;
+        }
+
         status = golioth_gateway_device_cert_set(_client, context->buf, context->len, 5);
         if (status != GOLIOTH_OK)
         {
@@ -84,11 +161,44 @@ int pouch_gateway_device_cert_finish(struct pouch_gateway_device_cert_context *c
         }
     }
 
+    return 0;
+}
+
+int pouch_gateway_device_cert_finish(struct pouch_gateway_device_cert_context *context)
+{
+    int err = device_cert_upload(context);
+    if (err)
+    {
+        return err;
+    }
+
     pouch_gateway_device_cert_abort(context);
 
     return 0;
 }
 
+static void device_cert_work_handler(struct k_work *work)
+{
+    struct pouch_gateway_device_cert_context *context =
+        CONTAINER_OF(work, struct pouch_gateway_device_cert_context, work);
+
+    int err = device_cert_upload(context);
+
+    context->done_cb(context, err, context->cb_arg);
+
+    pouch_gateway_device_cert_abort(context);
+}
+
+void pouch_gateway_device_cert_finish_async(struct pouch_gateway_device_cert_context *context,
+                                            pouch_gateway_device_cert_done_cb done_cb,
+                                            void *cb_arg)
+{
+    context->done_cb = done_cb;
+    context->cb_arg = cb_arg;
+    k_work_init(&context->work, device_cert_work_handler);
+    k_work_submit_to_queue(cert_work_q_get(), &context->work);
+}
+
 struct pouch_gateway_server_cert_context *pouch_gateway_server_cert_start(void)
 {
     struct pouch_gateway_server_cert_context *context =
@@ -105,30 +215,158 @@ bool pouch_gateway_server_cert_is_newest(const struct pouch_gateway_server_cert_
     return context->id == atomic_get(&server_crt_id);
 }
 
-static int server_crt_update(size_t len)
+static int server_crt_update(const uint8_t *buf, size_t len)
 {
     mbedtls_x509_crt cert_chain;
 
+    if (len > sizeof(server_crt_buf))
+    {
+        return -ENOMEM;
+    }
+
     mbedtls_x509_crt_init(&cert_chain);
 
-    int ret = mbedtls_x509_crt_parse(&cert_chain, server_crt_buf, len);
+    int ret = mbedtls_x509_crt_parse(&cert_chain, buf, len);
     if (ret < 0)
     {
         LOG_ERR("Failed to parse certificate: 0x%x", -ret);
+        mbedtls_x509_crt_free(&cert_chain);
         return -EIO;
     }
 
+    if (cert_chain.serial.len > sizeof(server_crt_serial))
+    {
+        LOG_ERR("Certificate serial too long: %zu", cert_chain.serial.len);
+        mbedtls_x509_crt_free(&cert_chain);
+        return -EINVAL;
+    }
+
     LOG_HEXDUMP_DBG(cert_chain.serial.p, cert_chain.serial.len, "cert_chain.serial");
 
-    memcpy(server_crt_serial, cert_chain.serial.p, cert_chain.serial.len);
-    atomic_set(&server_crt_serial_len, cert_chain.serial.len);
+    k_mutex_lock(&server_crt_lock, K_FOREVER);
 
+    memcpy(server_crt_buf, buf, len);
     atomic_set(&server_crt_len, len);
+    memcpy(server_crt_serial, cert_chain.serial.p, cert_chain.serial.len);
+    atomic_set(&server_crt_serial_len, cert_chain.serial.len);
     atomic_inc(&server_crt_id);
 
+    k_mutex_unlock(&server_crt_lock);
+
+    mbedtls_x509_crt_free(&cert_chain);
+
     return 0;
 }
 
+/* Returns -EALREADY if the certificate is unchanged, so nodes don't get it again */
+static int server_crt_replace(const uint8_t *buf, size_t len)
+{
+    k_mutex_lock(&server_crt_lock, K_FOREVER);
+
+    bool unchanged = len == atomic_get(&server_crt_len) && memcmp(buf, server_crt_buf, len) == 0;
+
+    k_mutex_unlock(&server_crt_lock);
+
+    if (unchanged)
+    {
+        return -EALREADY;
+    }
+
+    return server_crt_update(buf, len);
+}
+
+#ifdef CONFIG_POUCH_GATEWAY_SERVER_CERT_PERSIST
+
+static int server_crt_settings_set(const char *name,
+                                   size_t len,
+                                   settings_read_cb read_cb,
+                                   void *cb_arg)
+{
+    if (len > sizeof(server_crt_buf))
+    {
+        return -ENOMEM;
+    }
+
+    uint8_t *buf = malloc(len);
+    if (NULL == buf)
+    {
+        return -ENOMEM;
+    }
+
+    ssize_t ret = read_cb(cb_arg, buf, len);
+    if (ret == len)
+    {
+        if (0 == server_crt_replace(buf, len))
+        {
+            LOG_INF("Loaded stored server cert");
+        }
+    }
+
+    free(buf);
+
+    return ret < 0 ? ret : 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(pouch_gw_server_cert,
+                               SERVER_CRT_SETTINGS_KEY,
+                               NULL,
+                               server_crt_settings_set,
+                               NULL,
+                               NULL);
+
+#endif /* CONFIG_POUCH_GATEWAY_SERVER_CERT_PERSIST */
+
+static void server_crt_refresh_handler(struct k_work *work)
+{
+    int64_t now = k_uptime_get();
+
+    if (server_crt_fetched_at != 0
+        && now - server_crt_fetched_at
+               < CONFIG_POUCH_GATEWAY_SERVER_CERT_REFRESH_INTERVAL * MSEC_PER_SEC)
+    {
+        LOG_DBG("Server cert downloaded recently, not refreshing");
+        return;
+    }
+
+    uint8_t *buf = malloc(sizeof(server_crt_buf));
+    if (NULL == buf)
+    {
+        LOG_ERR("Could not allocate space for %s", "server cert");
+        return;
+    }
+
+    size_t len = sizeof(server_crt_buf);
+    enum golioth_status status = golioth_gateway_server_cert_get(_client, buf, &len);
+    if (status != GOLIOTH_OK)
+    {
+        LOG_ERR("Failed to download server certificate: %d", status);
+        free(buf);
+        return;
+    }
+
+    server_crt_fetched_at = now;
+
+    int err = server_crt_replace(buf, len);
+    if (-EALREADY == err)
+    {
+        LOG_DBG("Server cert unchanged");
+    }
+    else if (0 == err)
+    {
+        LOG_HEXDUMP_DBG(buf, len, "Server certificate");
+
+#ifdef CONFIG_POUCH_GATEWAY_SERVER_CERT_PERSIST
+        err = settings_save_one(SERVER_CRT_SETTINGS_KEY, buf, len);
+        if (err)
+        {
+            LOG_WRN("Failed to store server cert: %d", err);
+        }
+#endif
+    }
+
+    free(buf);
+}
+
 bool pouch_gateway_server_cert_is_complete(const struct pouch_gateway_server_cert_context *context)
 {
     return context->offset >= atomic_get(&server_crt_len);
@@ -139,13 +377,25 @@ int pouch_gateway_server_cert_get_data(struct pouch_gateway_server_cert_context
                                        size_t *dst_len,
                                        bool *is_last)
 {
-    size_t len = atomic_get(&server_crt_len);
+    int ret = 0;
 
     *is_last = false;
 
+    k_mutex_lock(&server_crt_lock, K_FOREVER);
+
+    size_t len = atomic_get(&server_crt_len);
+
+    if (context->id != atomic_get(&server_crt_id))
+    {
+        /* Replaced since the context was started, the data wouldn't fit */
+        ret = -ESTALE;
+        goto unlock;
+    }
+
     if (context->offset >= len)
     {
-        return -ENODATA;
+        ret = -ENODATA;
+        goto unlock;
     }
 
     if (*dst_len > len - context->offset)
@@ -161,11 +411,16 @@ int pouch_gateway_server_cert_get_data(struct pouch_gateway_server_cert_context
         *is_last = true;
     }
 
-    return 0;
+unlock:
+    k_mutex_unlock(&server_crt_lock);
+
+    return ret;
 }
 
 void pouch_gateway_server_cert_get_serial(void *dst, size_t *dst_len)
 {
+    k_mutex_lock(&server_crt_lock, K_FOREVER);
+
     size_t len = atomic_get(&server_crt_serial_len);
 
     if (*dst_len > len)
@@ -174,6 +429,8 @@ void pouch_gateway_server_cert_get_serial(void *dst, size_t *dst_len)
     }
 
     memcpy(dst, server_crt_serial, *dst_len);
+
+    k_mutex_unlock(&server_crt_lock);
 }
 
 void pouch_gateway_server_cert_abort(struct pouch_gateway_server_cert_context *context)
@@ -181,35 +438,53 @@ void pouch_gateway_server_cert_abort(struct pouch_gateway_server_cert_context *c
     free(context);
 }
 
-void pouch_gateway_cert_module_on_connected(struct golioth_client *client)
+void pouch_gateway_cert_module_init(void)
 {
-    enum golioth_status status;
-
-    _client = client;
-
-    if (IS_ENABLED(CONFIG_POUCH_GATEWAY_CLOUD))
+#ifdef CONFIG_POUCH_GATEWAY_SERVER_CERT_PERSIST
+    int err = settings_subsys_init();
+    if (0 == err)
     {
-        size_t len = sizeof(server_crt_buf);
-        status = golioth_gateway_server_cert_get(client, server_crt_buf, &len);
-        if (status != GOLIOTH_OK)
-        {
-            LOG_ERR("Failed to download server certificate: %d", status);
-            return;
-        }
+        err = settings_load_subtree(SERVER_CRT_SETTINGS_KEY);
+    }
 
-        server_crt_update(len);
+    if (err)
+    {
+        LOG_WRN("Failed to load stored server cert: %d", err);
     }
-    else if (IS_ENABLED(CONFIG_POUCH_GATEWAY_SERVER_CERT_BUILTIN))
+#endif
+
+    /* Serve the builtin certificate until one is downloaded */
+    if (IS_ENABLED(CONFIG_POUCH_GATEWAY_SERVER_CERT_BUILTIN) && 0 == atomic_get(&server_crt_len))
     {
         static const uint8_t server_crt_offline[] = {
 #include "pouch_gateway_server.pem.inc"
         };
 
-        memcpy(server_crt_buf, server_crt_offline, sizeof(server_crt_offline));
-        server_crt_update(sizeof(server_crt_offline));
+        if (0 == server_crt_update(server_crt_offline, sizeof(server_crt_offline)))
+        {
+            LOG_INF("Loaded builtin server cert");
+            LOG_HEXDUMP_DBG(server_crt_offline, sizeof(server_crt_offline), "Server certificate");
+        }
+    }
+}
 
-        LOG_INF("Loaded builtin server cert");
+void pouch_gateway_server_cert_refresh(void)
+{
+    if (IS_ENABLED(CONFIG_POUCH_GATEWAY_CLOUD) && NULL != _client)
+    {
+        /* The download blocks, so it runs on the cert work queue */
+        k_work_submit_to_queue(cert_work_q_get(), &server_crt_refresh_work);
     }
+}
+
+void pouch_gateway_cert_work_submit(struct k_work *work)
+{
+    k_work_submit_to_queue(cert_work_q_get(), work);
+}
+
+void pouch_gateway_cert_module_on_connected(struct golioth_client *client)
+{
+    _client = client;
 
-    LOG_HEXDUMP_DBG(server_crt_buf, atomic_get(&server_crt_len), "Server certificate");
+    pouch_gateway_server_cert_refresh();
 }
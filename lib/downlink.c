@@ -5,9 +5,13 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include <zephyr/kernel.h>
 #include <zephyr/sys/atomic.h>
+#include <zephyr/sys/barrier.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/sys/slist.h>
 
 #include <golioth/gateway.h>
 
@@ -25,29 +29,395 @@ enum
     DOWNLINK_FLAG_COUNT,
 };
 
+/* A block that didn't fit into the block buffer, kept on the heap */
+struct downlink_overflow
+{
+    sys_snode_t node;
+    size_t len;
+    bool is_last;
+    uint8_t data[];
+};
+
 struct pouch_gateway_downlink_context
 {
     pouch_gateway_downlink_data_available_cb data_available_cb;
     void *cb_arg;
-    struct k_fifo block_queue;
+    struct k_msgq block_queue;
+    struct block *block_queue_buf[CONFIG_POUCH_GATEWAY_DOWNLINK_MAX_QUEUED_BLOCKS];
     struct block *current_block;
+    struct downlink_overflow *current_overflow;
     size_t offset;
+    struct block_account blocks;
+    atomic_t queued_blocks;
+    sys_slist_t overflow;
+    size_t overflow_count;
+    struct k_mutex queue_lock;
+    struct k_spinlock lock;
+    bool receiving;
+    bool close_pending;
     ATOMIC_DEFINE(flags, DOWNLINK_FLAG_COUNT);
 };
 
 static struct golioth_client *_client;
 
-static void flush_block_queue(struct k_fifo *queue)
+static void noop_data_available(void *arg)
+{
+}
+
+#ifdef CONFIG_POUCH_GATEWAY_DOWNLINK_SHARE
+
+/*
+ * Nodes often receive identical downlinks, e.g. the same settings. Resident
+ * downlink blocks are kept in a table keyed by the CRC of their content, and
+ * a downlink that receives a block that is already resident takes a
+ * reference to it instead of storing another copy. Each downlink reads
+ * shared blocks through its own offset. Blocks that outlive the downlink
+ * that stored them are charged to shared_account.
+ */
+
+struct shared_block
+{
+    struct block *block;
+    uint32_t crc;
+    size_t refs;
+};
+
+static struct shared_block shared_blocks[CONFIG_POUCH_GATEWAY_DOWNLINK_SHARED_BLOCKS];
+static struct block_account shared_account;
+static struct k_spinlock shared_lock;
+
+/* Must be called with shared_lock held */
+static struct shared_block *find_shared(const struct block *block)
 {
-    struct block *block = k_fifo_get(queue, K_NO_WAIT);
-    while (NULL != block)
+    for (size_t i = 0; i < ARRAY_SIZE(shared_blocks); i++)
+    {
+        if (shared_blocks[i].block == block)
+        {
+            return &shared_blocks[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Returns a new reference to a resident block with the same content, or NULL */
+static struct block *get_shared_block(const uint8_t *data, size_t len, bool is_last)
+{
+    uint32_t crc = crc32_ieee(data, len);
+    struct block *block = NULL;
+
+    K_SPINLOCK(&shared_lock)
+    {
+        for (size_t i = 0; i < ARRAY_SIZE(shared_blocks); i++)
+        {
+            struct shared_block *shared = &shared_blocks[i];
+
+            if (shared->block != NULL && shared->crc == crc
+                && block_is_last(shared->block) == is_last
+                && block_equals(shared->block, data, len))
+            {
+                shared->refs++;
+                block = shared->block;
+                break;
+            }
+        }
+    }
+
+    return block;
+}
+
+static void add_shared_block(struct block *block)
+{
+    uint32_t crc = 0;
+    const void *data;
+    size_t offset = 0;
+
+    while (offset < block_length(block))
+    {
+        size_t len = block_span(block, offset, &data);
+
+        crc = crc32_ieee_update(crc, data, len);
+        offset += len;
+    }
+
+    K_SPINLOCK(&shared_lock)
+    {
+        /* Blocks that don't fit into the table are simply not shared */
+        struct shared_block *shared = find_shared(NULL);
+        if (shared != NULL)
+        {
+            shared->block = block;
+            shared->crc = crc;
+            shared->refs = 1;
+        }
+    }
+}
+
+static void put_block(struct block *block)
+{
+    bool free = true;
+
+    K_SPINLOCK(&shared_lock)
+    {
+        struct shared_block *shared = find_shared(block);
+        if (shared != NULL && --shared->refs > 0)
+        {
+            free = false;
+        }
+        else if (shared != NULL)
+        {
+            shared->block = NULL;
+        }
+    }
+
+    if (free)
     {
         block_free(block);
+    }
+}
+
+/* Hands blocks that other downlinks still use over to shared_account, so the
+   account can be closed */
+static void disown_shared_blocks(struct block_account *account)
+{
+    K_SPINLOCK(&shared_lock)
+    {
+        for (size_t i = 0; i < ARRAY_SIZE(shared_blocks); i++)
+        {
+            struct block *block = shared_blocks[i].block;
+
+            if (block != NULL && block_owner(block) == account)
+            {
+                block_move(block, &shared_account);
+            }
+        }
+    }
+}
+
+#else
+
+static struct block *get_shared_block(const uint8_t *data, size_t len, bool is_last)
+{
+    return NULL;
+}
+
+static void add_shared_block(struct block *block)
+{
+}
+
+static void put_block(struct block *block)
+{
+    block_free(block);
+}
+
+static void disown_shared_blocks(struct block_account *account)
+{
+}
+
+#endif /* CONFIG_POUCH_GATEWAY_DOWNLINK_SHARE */
 
-        block = k_fifo_get(queue, K_NO_WAIT);
+/* Returns -ENOMEM if the downlink has no room for the block right now */
+static int queue_block(struct pouch_gateway_downlink_context *downlink,
+                       const uint8_t *data,
+                       size_t len,
+                       bool is_last)
+{
+    if (atomic_get(&downlink->queued_blocks) >= CONFIG_POUCH_GATEWAY_DOWNLINK_MAX_QUEUED_BLOCKS)
+    {
+        return -ENOMEM;
+    }
+
+    struct block *block = get_shared_block(data, len, is_last);
+    if (NULL == block)
+    {
+        block = block_alloc(&downlink->blocks);
+        if (NULL == block)
+        {
+            return -ENOMEM;
+        }
+
+        if (0 != block_append(block, data, len))
+        {
+            block_free(block);
+            return -ENOMEM;
+        }
+
+        if (is_last)
+        {
+            block_mark_last(block);
+        }
+
+        add_shared_block(block);
+    }
+
+    atomic_inc(&downlink->queued_blocks);
+    k_msgq_put(&downlink->block_queue, &block, K_NO_WAIT);
+
+    return 0;
+}
+
+/* Must be called with queue_lock held. Returns -ENOMEM if the overflow queue
+   is full as well. */
+static int overflow_block(struct pouch_gateway_downlink_context *downlink,
+                          const uint8_t *data,
+                          size_t len,
+                          bool is_last)
+{
+    if (downlink->overflow_count >= CONFIG_POUCH_GATEWAY_DOWNLINK_OVERFLOW_BLOCKS)
+    {
+        return -ENOMEM;
+    }
+
+    struct downlink_overflow *entry = malloc(sizeof(*entry) + len);
+    if (NULL == entry)
+    {
+        return -ENOMEM;
+    }
+
+    memcpy(entry->data, data, len);
+    entry->len = len;
+    entry->is_last = is_last;
+
+    sys_slist_append(&downlink->overflow, &entry->node);
+    downlink->overflow_count++;
+
+    return 0;
+}
+
+/* Must be called with queue_lock held */
+static struct downlink_overflow *overflow_get(struct pouch_gateway_downlink_context *downlink)
+{
+    sys_snode_t *node = sys_slist_get(&downlink->overflow);
+    if (NULL == node)
+    {
+        return NULL;
+    }
+
+    downlink->overflow_count--;
+
+    return CONTAINER_OF(node, struct downlink_overflow, node);
+}
+
+/* Moves overflow blocks into the block buffer as it drains, in order */
+static void promote_overflow(struct pouch_gateway_downlink_context *downlink)
+{
+    k_mutex_lock(&downlink->queue_lock, K_FOREVER);
+
+    sys_snode_t *node;
+    while (NULL != (node = sys_slist_peek_head(&downlink->overflow)))
+    {
+        struct downlink_overflow *entry = CONTAINER_OF(node, struct downlink_overflow, node);
+
+        if (0 != queue_block(downlink, entry->data, entry->len, entry->is_last))
+        {
+            break;
+        }
+
+        free(overflow_get(downlink));
+    }
+
+    k_mutex_unlock(&downlink->queue_lock);
+}
+
+static void release_block(struct pouch_gateway_downlink_context *downlink, struct block *block)
+{
+    put_block(block);
+    atomic_dec(&downlink->queued_blocks);
+}
+
+static void flush_block_queue(struct pouch_gateway_downlink_context *downlink)
+{
+    struct block *block;
+
+    while (0 == k_msgq_get(&downlink->block_queue, &block, K_NO_WAIT))
+    {
+        release_block(downlink, block);
     }
 }
 
+static void free_downlink(struct pouch_gateway_downlink_context *downlink)
+{
+    struct downlink_overflow *entry;
+
+    while (NULL != (entry = overflow_get(downlink)))
+    {
+        free(entry);
+    }
+
+    free(downlink->current_overflow);
+
+    if (NULL != downlink->current_block)
+    {
+        release_block(downlink, downlink->current_block);
+    }
+
+    flush_block_queue(downlink);
+
+    LOG_DBG("Downlink used %zu fragments (%zu reserved), %zu allocations failed",
+            downlink->blocks.max_used,
+            downlink->blocks.reserved,
+            downlink->blocks.failed);
+
+    disown_shared_blocks(&downlink->blocks);
+    block_account_close(&downlink->blocks);
+
+    free(downlink);
+}
+
+static bool close_requested(struct pouch_gateway_downlink_context *downlink)
+{
+    bool close_pending = false;
+
+    K_SPINLOCK(&downlink->lock)
+    {
+        close_pending = downlink->close_pending;
+    }
+
+    return close_pending;
+}
+
+/* This runs on the Golioth client thread, which is shared by all sessions,
+   so it never waits for the node to drain its queue. A block that doesn't
+   fit goes to the overflow queue instead, and once that is non-empty all
+   following blocks do as well, so they stay in order. */
+static enum golioth_status receive_block(struct pouch_gateway_downlink_context *downlink,
+                                         const uint8_t *data,
+                                         size_t len,
+                                         bool is_last)
+{
+    if (atomic_test_bit(downlink->flags, DOWNLINK_FLAG_ABORTED) || close_requested(downlink))
+    {
+        return GOLIOTH_ERR_NACK;
+    }
+
+    k_mutex_lock(&downlink->queue_lock, K_FOREVER);
+
+    int err = -ENOMEM;
+    if (sys_slist_is_empty(&downlink->overflow))
+    {
+        err = queue_block(downlink, data, len, is_last);
+    }
+
+    if (0 != err)
+    {
+        err = overflow_block(downlink, data, len, is_last);
+    }
+
+    size_t overflow_count = downlink->overflow_count;
+
+    k_mutex_unlock(&downlink->queue_lock);
+
+    if (0 != err)
+    {
+        LOG_ERR("Downlink overflow full (%ld queued, %zu overflowed)",
+                atomic_get(&downlink->queued_blocks),
+                overflow_count);
+        return GOLIOTH_ERR_MEM_ALLOC;
+    }
+
+    return GOLIOTH_OK;
+}
+
 enum golioth_status pouch_gateway_downlink_block_cb(const uint8_t *data,
                                                     size_t len,
                                                     bool is_last,
@@ -55,31 +425,28 @@ enum golioth_status pouch_gateway_downlink_block_cb(const uint8_t *data,
 {
     struct pouch_gateway_downlink_context *downlink = arg;
 
-    if (atomic_test_bit(downlink->flags, DOWNLINK_FLAG_ABORTED))
+    K_SPINLOCK(&downlink->lock)
     {
-        flush_block_queue(&downlink->block_queue);
-        pouch_gateway_downlink_close(downlink);
-        return GOLIOTH_ERR_NACK;
+        downlink->receiving = true;
     }
 
-    struct block *block = block_alloc(NULL, K_SECONDS(CONFIG_POUCH_GATEWAY_DOWNLINK_BLOCK_TIMEOUT));
-    if (NULL == block)
+    enum golioth_status status = receive_block(downlink, data, len, is_last);
+
+    bool close_pending = false;
+
+    K_SPINLOCK(&downlink->lock)
     {
-        LOG_ERR("Failed to allocate block");
-        flush_block_queue(&downlink->block_queue);
-        pouch_gateway_downlink_close(downlink);
-        return GOLIOTH_ERR_MEM_ALLOC;
+        downlink->receiving = false;
+        close_pending = downlink->close_pending;
     }
 
-    block_append(block, data, len);
-
-    if (is_last)
+    if (GOLIOTH_OK != status || close_pending)
     {
-        block_mark_last(block);
+        free_downlink(downlink);
+        return (GOLIOTH_OK == status) ? GOLIOTH_ERR_NACK : status;
     }
-    k_fifo_put(&downlink->block_queue, block);
 
-    if (NULL == downlink->current_block
+    if (NULL == downlink->current_block && NULL == downlink->current_overflow
         && atomic_test_and_clear_bit(downlink->flags, DOWNLINK_FLAG_CLIENT_WAITING))
     {
         downlink->data_available_cb(downlink->cb_arg);
@@ -127,21 +494,50 @@ struct pouch_gateway_downlink_context *pouch_gateway_downlink_open(
         downlink->data_available_cb = data_available_cb;
         downlink->cb_arg = cb_arg;
         downlink->current_block = NULL;
+        downlink->current_overflow = NULL;
         downlink->offset = 0;
+        block_account_open(&downlink->blocks, CONFIG_POUCH_GATEWAY_DOWNLINK_BLOCK_WEIGHT);
+        atomic_set(&downlink->queued_blocks, 0);
+        sys_slist_init(&downlink->overflow);
+        downlink->overflow_count = 0;
+        k_mutex_init(&downlink->queue_lock);
+        memset(&downlink->lock, 0, sizeof(downlink->lock));
+        downlink->receiving = false;
+        downlink->close_pending = false;
         atomic_clear_bit(downlink->flags, DOWNLINK_FLAG_COMPLETE);
         atomic_clear_bit(downlink->flags, DOWNLINK_FLAG_ABORTED);
         atomic_set_bit(downlink->flags, DOWNLINK_FLAG_CLIENT_WAITING);
-        k_fifo_init(&downlink->block_queue);
+        k_msgq_init(&downlink->block_queue,
+                    (char *) downlink->block_queue_buf,
+                    sizeof(struct block *),
+                    ARRAY_SIZE(downlink->block_queue_buf));
     }
 
     return downlink;
 }
 
-int pouch_gateway_downlink_get_data(struct pouch_gateway_downlink_context *downlink,
-                                    void *dst,
-                                    size_t *dst_len,
-                                    bool *is_last)
+void pouch_gateway_downlink_set_callback(struct pouch_gateway_downlink_context *downlink,
+                                         pouch_gateway_downlink_data_available_cb data_available_cb,
+                                         void *arg)
 {
+    /* The callback runs on the Golioth client thread, so make sure it never
+       sees the new function with the old argument */
+    downlink->data_available_cb = noop_data_available;
+    barrier_dmem_fence_full();
+    downlink->cb_arg = arg;
+    barrier_dmem_fence_full();
+    downlink->data_available_cb = data_available_cb;
+}
+
+/* Returns the next contiguous span of downlink data without copying it. The
+   span stays valid until it is consumed. */
+static int downlink_peek(struct pouch_gateway_downlink_context *downlink,
+                         const void **data,
+                         size_t *len,
+                         bool *is_last)
+{
+    *data = NULL;
+    *len = 0;
     *is_last = false;
 
     if (pouch_gateway_downlink_is_complete(downlink))
@@ -149,55 +545,144 @@ int pouch_gateway_downlink_get_data(struct pouch_gateway_downlink_context *downl
         return -ENODATA;
     }
 
-    size_t total_bytes_copied = 0;
-
-    while (*dst_len)
+    if (NULL == downlink->current_block && NULL == downlink->current_overflow
+        && 0 != k_msgq_get(&downlink->block_queue, &downlink->current_block, K_NO_WAIT))
     {
-        if (NULL == downlink->current_block)
+        downlink->current_block = NULL;
+
+        /* Overflow blocks that couldn't be moved into the block buffer yet
+           are sent from the heap, they always follow the queued blocks */
+        k_mutex_lock(&downlink->queue_lock, K_FOREVER);
+
+        if (0 != k_msgq_get(&downlink->block_queue, &downlink->current_block, K_NO_WAIT))
+        {
+            downlink->current_block = NULL;
+            downlink->current_overflow = overflow_get(downlink);
+        }
+
+        k_mutex_unlock(&downlink->queue_lock);
+
+        if (NULL == downlink->current_block && NULL == downlink->current_overflow)
         {
-            downlink->current_block = k_fifo_get(&downlink->block_queue, K_NO_WAIT);
-            if (NULL == downlink->current_block)
+            if (atomic_test_bit(downlink->flags, DOWNLINK_FLAG_ABORTED))
             {
-                *dst_len = total_bytes_copied;
-                if (atomic_test_bit(downlink->flags, DOWNLINK_FLAG_ABORTED))
-                {
-                    /* We have aborted the downlink and the block queue is empty */
-                    *is_last = true;
-                    atomic_set_bit(downlink->flags, DOWNLINK_FLAG_COMPLETE);
-                    return 0;
-                }
-                if (0 == *dst_len)
-                {
-                    /* We could not provide any data to the client, so we will
-                       notify them the next time we receive a block */
-                    atomic_set_bit(downlink->flags, DOWNLINK_FLAG_CLIENT_WAITING);
-                }
-                return -EAGAIN;
+                /* We have aborted the downlink and the block queue is empty */
+                *is_last = true;
+                return 0;
             }
+
+            return -EAGAIN;
         }
+    }
 
-        size_t bytes_to_copy =
-            MIN(*dst_len, block_length(downlink->current_block) - downlink->offset);
-        block_get(downlink->current_block, downlink->offset, dst, bytes_to_copy);
+    if (NULL != downlink->current_overflow)
+    {
+        struct downlink_overflow *entry = downlink->current_overflow;
 
-        downlink->offset += bytes_to_copy;
-        *dst_len -= bytes_to_copy;
-        dst = (void *) ((intptr_t) dst + bytes_to_copy);
-        total_bytes_copied += bytes_to_copy;
+        *data = &entry->data[downlink->offset];
+        *len = entry->len - downlink->offset;
+        *is_last = entry->is_last;
 
-        if (block_length(downlink->current_block) == downlink->offset)
-        {
-            *is_last = block_is_last(downlink->current_block);
+        return 0;
+    }
 
-            block_free(downlink->current_block);
-            downlink->offset = 0;
-            downlink->current_block = k_fifo_get(&downlink->block_queue, K_NO_WAIT);
+    *len = block_span(downlink->current_block, downlink->offset, data);
+    *is_last = block_is_last(downlink->current_block)
+        && downlink->offset + *len == block_length(downlink->current_block);
 
-            if (*is_last)
+    return 0;
+}
+
+static void downlink_consume(struct pouch_gateway_downlink_context *downlink, size_t len)
+{
+    if (NULL != downlink->current_overflow)
+    {
+        struct downlink_overflow *entry = downlink->current_overflow;
+
+        downlink->offset += len;
+
+        if (entry->len == downlink->offset)
+        {
+            if (entry->is_last)
             {
                 atomic_set_bit(downlink->flags, DOWNLINK_FLAG_COMPLETE);
-                break;
             }
+
+            free(entry);
+            downlink->current_overflow = NULL;
+            downlink->offset = 0;
+        }
+        return;
+    }
+
+    if (NULL == downlink->current_block)
+    {
+        if (atomic_test_bit(downlink->flags, DOWNLINK_FLAG_ABORTED))
+        {
+            atomic_set_bit(downlink->flags, DOWNLINK_FLAG_COMPLETE);
+        }
+        return;
+    }
+
+    downlink->offset += len;
+
+    if (block_length(downlink->current_block) == downlink->offset)
+    {
+        bool is_last = block_is_last(downlink->current_block);
+
+        release_block(downlink, downlink->current_block);
+        downlink->current_block = NULL;
+        downlink->offset = 0;
+
+        if (is_last)
+        {
+            atomic_set_bit(downlink->flags, DOWNLINK_FLAG_COMPLETE);
+        }
+        else
+        {
+            promote_overflow(downlink);
+        }
+    }
+}
+
+int pouch_gateway_downlink_get_data(struct pouch_gateway_downlink_context *downlink,
+                                    void *dst,
+                                    size_t *dst_len,
+                                    bool *is_last)
+{
+    size_t total_bytes_copied = 0;
+
+    *is_last = false;
+
+    while (total_bytes_copied < *dst_len)
+    {
+        const void *span;
+        size_t span_len;
+        bool span_is_last;
+
+        int ret = downlink_peek(downlink, &span, &span_len, &span_is_last);
+        if (-EAGAIN == ret && 0 == total_bytes_copied)
+        {
+            /* We could not provide any data to the client, so we will
+               notify them the next time we receive a block */
+            atomic_set_bit(downlink->flags, DOWNLINK_FLAG_CLIENT_WAITING);
+        }
+        if (0 != ret)
+        {
+            *dst_len = total_bytes_copied;
+            return ret;
+        }
+
+        size_t bytes_to_copy = MIN(span_len, *dst_len - total_bytes_copied);
+        memcpy((uint8_t *) dst + total_bytes_copied, span, bytes_to_copy);
+        total_bytes_copied += bytes_to_copy;
+
+        downlink_consume(downlink, bytes_to_copy);
+
+        if (span_is_last && bytes_to_copy == span_len)
+        {
+            *is_last = true;
+            break;
         }
     }
 
@@ -212,12 +697,25 @@ bool pouch_gateway_downlink_is_complete(const struct pouch_gateway_downlink_cont
 
 void pouch_gateway_downlink_close(struct pouch_gateway_downlink_context *downlink)
 {
-    if (NULL != downlink->current_block)
+    bool deferred = false;
+
+    K_SPINLOCK(&downlink->lock)
     {
-        block_free(downlink->current_block);
+        /* A block callback that is running frees the downlink once it
+           returns */
+        if (downlink->receiving)
+        {
+            downlink->close_pending = true;
+            deferred = true;
+        }
     }
 
-    free(downlink);
+    if (deferred)
+    {
+        return;
+    }
+
+    free_downlink(downlink);
 }
 
 void pouch_gateway_downlink_abort(struct pouch_gateway_downlink_context *downlink)
@@ -238,4 +736,8 @@ void pouch_gateway_downlink_abort(struct pouch_gateway_downlink_context *downlin
 void pouch_gateway_downlink_module_init(struct golioth_client *client)
 {
     _client = client;
+
+#ifdef CONFIG_POUCH_GATEWAY_DOWNLINK_SHARE
+    block_account_open(&shared_account, CONFIG_POUCH_GATEWAY_DOWNLINK_BLOCK_WEIGHT);
+#endif
 }
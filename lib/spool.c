@@ -0,0 +1,608 @@
+/*
+ * Copyright (c) 2025 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include <zephyr/fs/fcb.h>
+#include <zephyr/kernel.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/sys/atomic.h>
+
+#include <golioth/gateway.h>
+
+#include "spool.h"
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(spool);
+
+#define SPOOL_PARTITION_ID FIXED_PARTITION_ID(pouch_spool_partition)
+#define SPOOL_MAGIC 0x706f7563 /* "pouc" */
+#define SPOOL_VERSION 1
+
+/*
+ * The spool is an FCB of records. Uplinks that are spooled at the same time
+ * interleave, so every record carries the session it belongs to. A session
+ * is complete once its LAST data record is stored, and it is skipped on
+ * replay once a DONE record for it is stored. Sessions that are neither
+ * complete nor done after a reboot were cut short and are dropped. Every
+ * failed delivery attempt stores a FAILED record, and a session that the
+ * cloud rejects, or that failed too often, is marked done without being
+ * delivered, so it can't hold up the sessions behind it.
+ */
+
+enum spool_record_type
+{
+    SPOOL_RECORD_DATA,
+    SPOOL_RECORD_DONE,
+    SPOOL_RECORD_FAILED,
+};
+
+enum spool_record_flags
+{
+    SPOOL_RECORD_FIRST = BIT(0),
+    SPOOL_RECORD_LAST = BIT(1),
+};
+
+struct spool_record_hdr
+{
+    uint32_t session;
+    uint16_t len;
+    uint8_t type;
+    uint8_t flags;
+} __packed;
+
+enum drain_state
+{
+    DRAIN_IDLE,
+    DRAIN_SEND,
+    DRAIN_WAIT,
+    DRAIN_COMPLETE,
+    DRAIN_FAILED,
+    DRAIN_REJECTED,
+};
+
+static struct fcb spool_fcb;
+static struct flash_sector spool_sectors[CONFIG_POUCH_GATEWAY_SPOOL_MAX_SECTORS];
+static atomic_t next_session;
+static uint32_t boot_session;
+
+static uint8_t write_buf[ROUND_UP(sizeof(struct spool_record_hdr)
+                                      + CONFIG_GOLIOTH_BLOCKWISE_UPLOAD_MAX_BLOCK_SIZE,
+                                  8)];
+static K_MUTEX_DEFINE(write_lock);
+
+static struct
+{
+    struct golioth_client *client;
+    struct gateway_uplink *uplink;
+    atomic_t state;
+    uint32_t session;
+    uint32_t block_idx;
+    bool sent_last;
+    struct fcb_entry loc;
+    struct fcb_entry next_loc;
+    uint8_t buf[CONFIG_GOLIOTH_BLOCKWISE_UPLOAD_MAX_BLOCK_SIZE];
+} drain;
+
+static void drain_handler(struct k_work *work);
+static K_WORK_DEFINE(drain_work, drain_handler);
+
+/* Flash writes and erases may take long enough to stall the Bluetooth stack
+   or the system work queue, so they all run on a work queue of their own */
+static K_THREAD_STACK_DEFINE(spool_work_stack, CONFIG_POUCH_GATEWAY_SPOOL_WORK_STACK_SIZE);
+static struct k_work_q spool_work_q;
+
+static void abort_handler(struct k_work *work);
+static K_WORK_DEFINE(abort_work, abort_handler);
+K_MSGQ_DEFINE(abort_msgq, sizeof(uint32_t), CONFIG_POUCH_GATEWAY_UPLINK_MAX_SESSIONS, 4);
+
+static int append_record(uint32_t session,
+                         enum spool_record_type type,
+                         uint8_t flags,
+                         const void *data,
+                         size_t len)
+{
+    struct spool_record_hdr hdr = {
+        .session = session,
+        .len = len,
+        .type = type,
+        .flags = flags,
+    };
+    size_t total_len = ROUND_UP(sizeof(hdr) + len, flash_area_align(spool_fcb.fap));
+    struct fcb_entry loc;
+    int err;
+
+    if (total_len > sizeof(write_buf))
+    {
+        return -EINVAL;
+    }
+
+    k_mutex_lock(&write_lock, K_FOREVER);
+
+    memcpy(write_buf, &hdr, sizeof(hdr));
+    if (len > 0)
+    {
+        memcpy(&write_buf[sizeof(hdr)], data, len);
+    }
+    memset(&write_buf[sizeof(hdr) + len], 0xff, total_len - sizeof(hdr) - len);
+
+    err = fcb_append(&spool_fcb, total_len, &loc);
+    if (err)
+    {
+        goto unlock;
+    }
+
+    err = flash_area_write(spool_fcb.fap, FCB_ENTRY_FA_DATA_OFF(loc), write_buf, total_len);
+    if (err)
+    {
+        goto unlock;
+    }
+
+    err = fcb_append_finish(&spool_fcb, &loc);
+
+unlock:
+    k_mutex_unlock(&write_lock);
+
+    return err;
+}
+
+static int read_hdr(const struct fcb_entry *loc, struct spool_record_hdr *hdr)
+{
+    return flash_area_read(spool_fcb.fap, FCB_ENTRY_FA_DATA_OFF(*loc), hdr, sizeof(*hdr));
+}
+
+static bool find_record(struct fcb_entry *loc,
+                        uint32_t session,
+                        enum spool_record_type type,
+                        uint8_t flags,
+                        struct spool_record_hdr *hdr)
+{
+    while (0 == fcb_getnext(&spool_fcb, loc))
+    {
+        if (0 == read_hdr(loc, hdr) && hdr->session == session && hdr->type == type
+            && (hdr->flags & flags) == flags)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool session_is_done(uint32_t session)
+{
+    struct fcb_entry loc = {0};
+    struct spool_record_hdr hdr;
+
+    return find_record(&loc, session, SPOOL_RECORD_DONE, 0, &hdr);
+}
+
+static bool session_is_complete(uint32_t session)
+{
+    struct fcb_entry loc = {0};
+    struct spool_record_hdr hdr;
+
+    return find_record(&loc, session, SPOOL_RECORD_DATA, SPOOL_RECORD_LAST, &hdr);
+}
+
+static size_t session_failures(uint32_t session)
+{
+    struct fcb_entry loc = {0};
+    struct spool_record_hdr hdr;
+    size_t failures = 0;
+
+    while (find_record(&loc, session, SPOOL_RECORD_FAILED, 0, &hdr))
+    {
+        failures++;
+    }
+
+    return failures;
+}
+
+/* Find the oldest complete session that has not been delivered yet */
+static bool pick_session(uint32_t *session, struct fcb_entry *first)
+{
+    struct fcb_entry loc = {0};
+    struct spool_record_hdr hdr;
+
+    while (0 == fcb_getnext(&spool_fcb, &loc))
+    {
+        if (0 != read_hdr(&loc, &hdr) || hdr.type != SPOOL_RECORD_DATA
+            || !(hdr.flags & SPOOL_RECORD_FIRST) || session_is_done(hdr.session))
+        {
+            continue;
+        }
+
+        if (!session_is_complete(hdr.session))
+        {
+            if (hdr.session < boot_session)
+            {
+                LOG_WRN("Dropping incomplete spooled session %u", hdr.session);
+                append_record(hdr.session, SPOOL_RECORD_DONE, 0, NULL, 0);
+            }
+
+            /* Otherwise the session is still being written */
+            continue;
+        }
+
+        *session = hdr.session;
+        *first = loc;
+        return true;
+    }
+
+    return false;
+}
+
+/* Erase the oldest sectors once all sessions stored in them are done */
+static void reclaim(void)
+{
+    while (spool_fcb.f_oldest != spool_fcb.f_active.fe_sector)
+    {
+        struct flash_sector *oldest = spool_fcb.f_oldest;
+        struct fcb_entry loc = {
+            .fe_sector = oldest,
+            .fe_elem_off = 0,
+        };
+        struct spool_record_hdr hdr;
+
+        while (0 == fcb_getnext(&spool_fcb, &loc) && loc.fe_sector == oldest)
+        {
+            if (0 != read_hdr(&loc, &hdr)
+                || (hdr.type == SPOOL_RECORD_DATA && !session_is_done(hdr.session)))
+            {
+                return;
+            }
+        }
+
+        LOG_DBG("Reclaiming spool sector at 0x%lx", (unsigned long) oldest->fs_off);
+
+        if (0 != fcb_rotate(&spool_fcb))
+        {
+            return;
+        }
+    }
+}
+
+static enum golioth_status drain_downlink_block_cb(const uint8_t *data,
+                                                   size_t len,
+                                                   bool is_last,
+                                                   void *arg)
+{
+    LOG_WRN("Dropping %zu bytes of downlink for spooled uplink", len);
+
+    return GOLIOTH_OK;
+}
+
+static void drain_downlink_end_cb(enum golioth_status status,
+                                  const struct golioth_coap_rsp_code *coap_rsp_code,
+                                  void *arg)
+{
+}
+
+static void drain_block_cb(struct golioth_client *client,
+                           enum golioth_status status,
+                           const struct golioth_coap_rsp_code *coap_rsp_code,
+                           const char *path,
+                           size_t block_size,
+                           void *arg)
+{
+    if (status == GOLIOTH_ERR_COAP_RESPONSE && coap_rsp_code != NULL
+        && coap_rsp_code->code_class == 4)
+    {
+        /* Client errors, such as a malformed pouch or a revoked device,
+           won't go away by sending the session again */
+        LOG_ERR("Spooled block rejected: %d.%02d",
+                coap_rsp_code->code_class,
+                coap_rsp_code->code_detail);
+        atomic_set(&drain.state, DRAIN_REJECTED);
+    }
+    else if (status != GOLIOTH_OK)
+    {
+        LOG_ERR("Failed to deliver spooled block: %d", status);
+        atomic_set(&drain.state, DRAIN_FAILED);
+    }
+    else if (drain.sent_last)
+    {
+        atomic_set(&drain.state, DRAIN_COMPLETE);
+    }
+    else
+    {
+        drain.loc = drain.next_loc;
+        atomic_set(&drain.state, DRAIN_SEND);
+    }
+
+    k_work_submit_to_queue(&spool_work_q, &drain_work);
+}
+
+static enum drain_state drain_send(void)
+{
+    struct spool_record_hdr hdr;
+    struct spool_record_hdr next_hdr;
+
+    if (0 != read_hdr(&drain.loc, &hdr) || hdr.len > sizeof(drain.buf)
+        || 0
+            != flash_area_read(spool_fcb.fap,
+                               FCB_ENTRY_FA_DATA_OFF(drain.loc) + sizeof(hdr),
+                               drain.buf,
+                               hdr.len))
+    {
+        LOG_ERR("Failed to read spooled block");
+        return DRAIN_FAILED;
+    }
+
+    bool is_last = hdr.flags & SPOOL_RECORD_LAST;
+
+    if (!is_last)
+    {
+        drain.next_loc = drain.loc;
+        if (!find_record(&drain.next_loc, drain.session, SPOOL_RECORD_DATA, 0, &next_hdr))
+        {
+            LOG_ERR("Spooled session %u is truncated", drain.session);
+            return DRAIN_REJECTED;
+        }
+
+        /* An uplink closed right after a full block ends with an empty record */
+        is_last = (next_hdr.flags & SPOOL_RECORD_LAST) && 0 == next_hdr.len;
+    }
+
+    if (0 == hdr.len)
+    {
+        if (is_last)
+        {
+            return DRAIN_COMPLETE;
+        }
+
+        drain.loc = drain.next_loc;
+        return DRAIN_SEND;
+    }
+
+    drain.sent_last = is_last;
+
+    /* The callback may run before golioth_gateway_uplink_block() returns */
+    atomic_set(&drain.state, DRAIN_WAIT);
+
+    enum golioth_status status = golioth_gateway_uplink_block(drain.uplink,
+                                                              drain.block_idx++,
+                                                              drain.buf,
+                                                              hdr.len,
+                                                              is_last,
+                                                              drain_block_cb,
+                                                              NULL);
+    if (status != GOLIOTH_OK)
+    {
+        LOG_ERR("Failed to deliver spooled block: %d", status);
+        return DRAIN_FAILED;
+    }
+
+    return DRAIN_WAIT;
+}
+
+static void drain_finish(void)
+{
+    golioth_gateway_uplink_finish(drain.uplink);
+    drain.uplink = NULL;
+}
+
+static void drain_handler(struct k_work *work)
+{
+    enum drain_state state = atomic_get(&drain.state);
+
+    if (state == DRAIN_COMPLETE)
+    {
+        LOG_INF("Delivered spooled session %u", drain.session);
+
+        drain_finish();
+        append_record(drain.session, SPOOL_RECORD_DONE, 0, NULL, 0);
+        reclaim();
+        state = DRAIN_SEND;
+    }
+    else if (state == DRAIN_FAILED)
+    {
+        drain_finish();
+        append_record(drain.session, SPOOL_RECORD_FAILED, 0, NULL, 0);
+
+        size_t failures = session_failures(drain.session);
+        if (failures < CONFIG_POUCH_GATEWAY_SPOOL_MAX_ATTEMPTS)
+        {
+            /* The session is retried on the next drain */
+            LOG_WRN("Spooled session %u failed %zu times", drain.session, failures);
+            atomic_set(&drain.state, DRAIN_IDLE);
+            return;
+        }
+
+        LOG_ERR("Dropping spooled session %u after %zu attempts", drain.session, failures);
+
+        append_record(drain.session, SPOOL_RECORD_DONE, 0, NULL, 0);
+        reclaim();
+        state = DRAIN_SEND;
+    }
+    else if (state == DRAIN_REJECTED)
+    {
+        LOG_ERR("Dropping spooled session %u, rejected", drain.session);
+
+        drain_finish();
+        append_record(drain.session, SPOOL_RECORD_DONE, 0, NULL, 0);
+        reclaim();
+        state = DRAIN_SEND;
+    }
+
+    if (state != DRAIN_SEND)
+    {
+        return;
+    }
+
+    if (NULL == drain.uplink)
+    {
+        if (!pick_session(&drain.session, &drain.loc))
+        {
+            LOG_DBG("Spool drained");
+            reclaim();
+            atomic_set(&drain.state, DRAIN_IDLE);
+            return;
+        }
+
+        LOG_INF("Delivering spooled session %u", drain.session);
+
+        drain.uplink = golioth_gateway_uplink_start(drain.client,
+                                                    drain_downlink_block_cb,
+                                                    drain_downlink_end_cb,
+                                                    NULL);
+        if (NULL == drain.uplink)
+        {
+            LOG_ERR("Failed to start blockwise upload");
+            atomic_set(&drain.state, DRAIN_IDLE);
+            return;
+        }
+
+        drain.block_idx = 0;
+    }
+
+    state = drain_send();
+    if (state == DRAIN_WAIT)
+    {
+        return;
+    }
+
+    atomic_set(&drain.state, state);
+    k_work_submit_to_queue(&spool_work_q, &drain_work);
+}
+
+static int find_max_session(struct fcb_entry_ctx *loc_ctx, void *arg)
+{
+    uint32_t *max_session = arg;
+    struct spool_record_hdr hdr;
+
+    if (0 == flash_area_read(loc_ctx->fap, FCB_ENTRY_FA_DATA_OFF(loc_ctx->loc), &hdr, sizeof(hdr))
+        && hdr.session >= *max_session)
+    {
+        *max_session = hdr.session + 1;
+    }
+
+    return 0;
+}
+
+static void abort_handler(struct k_work *work)
+{
+    uint32_t session;
+
+    while (0 == k_msgq_get(&abort_msgq, &session, K_NO_WAIT))
+    {
+        append_record(session, SPOOL_RECORD_DONE, 0, NULL, 0);
+    }
+}
+
+int spool_init(void)
+{
+    static bool work_q_started;
+    uint32_t sector_cnt = ARRAY_SIZE(spool_sectors);
+    int err;
+
+    if (!work_q_started)
+    {
+        k_work_queue_start(&spool_work_q,
+                           spool_work_stack,
+                           K_THREAD_STACK_SIZEOF(spool_work_stack),
+                           CONFIG_POUCH_GATEWAY_SPOOL_WORK_PRIORITY,
+                           NULL);
+        work_q_started = true;
+    }
+
+    err = flash_area_get_sectors(SPOOL_PARTITION_ID, &sector_cnt, spool_sectors);
+    if (err)
+    {
+        LOG_ERR("Failed to get spool sectors: %d", err);
+        return err;
+    }
+
+    spool_fcb.f_magic = SPOOL_MAGIC;
+    spool_fcb.f_version = SPOOL_VERSION;
+    spool_fcb.f_sector_cnt = sector_cnt;
+    spool_fcb.f_scratch_cnt = 0;
+    spool_fcb.f_sectors = spool_sectors;
+
+    err = fcb_init(SPOOL_PARTITION_ID, &spool_fcb);
+    if (err)
+    {
+        const struct flash_area *fap;
+
+        LOG_WRN("Spool is corrupted, erasing (err %d)", err);
+
+        err = flash_area_open(SPOOL_PARTITION_ID, &fap);
+        if (err)
+        {
+            return err;
+        }
+
+        err = flash_area_erase(fap, 0, fap->fa_size);
+        flash_area_close(fap);
+        if (err)
+        {
+            return err;
+        }
+
+        err = fcb_init(SPOOL_PARTITION_ID, &spool_fcb);
+        if (err)
+        {
+            LOG_ERR("Failed to init spool: %d", err);
+            return err;
+        }
+    }
+
+    uint32_t max_session = 0;
+    fcb_walk(&spool_fcb, NULL, find_max_session, &max_session);
+
+    boot_session = max_session;
+    atomic_set(&next_session, max_session);
+
+    LOG_INF("Spool ready, %s", fcb_is_empty(&spool_fcb) ? "empty" : "pending uplinks");
+
+    return 0;
+}
+
+uint32_t spool_session_open(void)
+{
+    return atomic_inc(&next_session);
+}
+
+int spool_session_write(uint32_t session,
+                        const void *data,
+                        size_t len,
+                        bool is_first,
+                        bool is_last)
+{
+    uint8_t flags = (is_first ? SPOOL_RECORD_FIRST : 0) | (is_last ? SPOOL_RECORD_LAST : 0);
+
+    return append_record(session, SPOOL_RECORD_DATA, flags, data, len);
+}
+
+void spool_session_abort(uint32_t session)
+{
+    if (0 != k_msgq_put(&abort_msgq, &session, K_NO_WAIT))
+    {
+        /* The session is dropped on the next boot instead */
+        LOG_WRN("Failed to abort spooled session %u", session);
+        return;
+    }
+
+    k_work_submit_to_queue(&spool_work_q, &abort_work);
+}
+
+void spool_submit(struct k_work *work)
+{
+    k_work_submit_to_queue(&spool_work_q, work);
+}
+
+void spool_drain(struct golioth_client *client)
+{
+    if (!atomic_cas(&drain.state, DRAIN_IDLE, DRAIN_SEND))
+    {
+        return;
+    }
+
+    drain.client = client;
+
+    k_work_submit_to_queue(&spool_work_q, &drain_work);
+}
@@ -0,0 +1,25 @@
+/*
+ * Copyright (c) 2025 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct golioth_client;
+struct k_work;
+
+int spool_init(void);
+uint32_t spool_session_open(void);
+int spool_session_write(uint32_t session,
+                        const void *data,
+                        size_t len,
+                        bool is_first,
+                        bool is_last);
+void spool_session_abort(uint32_t session);
+void spool_submit(struct k_work *work);
+void spool_drain(struct golioth_client *client);
@@ -4,13 +4,15 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
-#include <stdlib.h>
-
+#include <zephyr/kernel.h>
 #include <zephyr/sys/atomic_types.h>
 
 #include <golioth/gateway.h>
 #include <golioth/stream.h>
 
+#include "aggregate.h"
+#include "block.h"
+#include "spool.h"
 #include <pouch_gateway/downlink.h>
 #include <pouch_gateway/uplink.h>
 
@@ -20,159 +22,691 @@ LOG_MODULE_REGISTER(uplink);
 enum pouch_flags
 {
     POUCH_UPLINK_CLOSED,
-    POUCH_UPLINK_SENDING,
+    POUCH_UPLINK_FAILED,
+    POUCH_UPLINK_DONE,
+    POUCH_UPLINK_THROTTLED,
+    POUCH_UPLINK_HELD,
+    POUCH_UPLINK_AWAIT_CLOUD,
 };
 
-struct pouch_block
+struct pouch_uplink_slot
 {
-    sys_snode_t node;
-    size_t len;
-    uint8_t data[CONFIG_GOLIOTH_BLOCKWISE_UPLOAD_MAX_BLOCK_SIZE];
+    struct pouch_gateway_uplink *uplink;
+    struct block *block;
+    uint32_t idx;
+    uint8_t retries;
+    bool retry_pending;
+    bool is_last;
+    struct k_work_delayable retry_work;
+    struct k_work spool_work;
 };
 
 struct pouch_gateway_uplink
 {
+    sys_snode_t await_node;
     struct gateway_uplink *session;
+    struct pouch_gateway_downlink_context *downlink;
+    bool spooled;
+    uint32_t spool_session;
+    bool aggregating;
+    bool aggregated;
+    struct k_mutex lock;
+    atomic_t refs;
     uint32_t block_idx;
     atomic_t flags[1];
-    struct pouch_block *wblock;
-    struct pouch_block *rblock;
+    struct block_account blocks;
+    struct block *wblock;
     sys_slist_t queue;
+    size_t queue_len;
+    struct pouch_uplink_slot inflight[CONFIG_POUCH_GATEWAY_UPLINK_WINDOW];
+    size_t inflight_count;
+    int64_t deadline;
     pouch_gateway_uplink_end_cb end_cb;
-    void *end_cb_arg;
+    pouch_gateway_uplink_resume_cb resume_cb;
+    void *cb_arg;
 };
 
+K_MEM_SLAB_DEFINE_STATIC(uplink_slab,
+                         sizeof(struct pouch_gateway_uplink),
+                         CONFIG_POUCH_GATEWAY_UPLINK_MAX_SESSIONS,
+                         4);
+
 static struct golioth_client *client;
+static bool spool_ready;
+
+/* Uplinks opened before the cloud was connected, held in RAM until it is */
+static sys_slist_t await_cloud_uplinks;
+static K_MUTEX_DEFINE(await_cloud_lock);
+
+/* Blocks are stored as fragment chains. Blocks that span more than one
+   fragment are assembled here right before they are handed over. The Golioth
+   client copies the payload of each request, so one view is shared by all
+   uplinks. */
+static uint8_t block_view[CONFIG_GOLIOTH_BLOCKWISE_UPLOAD_MAX_BLOCK_SIZE];
+static K_MUTEX_DEFINE(block_view_lock);
+
+/* Returns the block data, must be followed by put_block_view() */
+static const void *get_block_view(const struct block *block)
+{
+    const void *data;
+
+    if (block_span(block, 0, &data) == block_length(block))
+    {
+        return data;
+    }
+
+    k_mutex_lock(&block_view_lock, K_FOREVER);
+
+    block_get(block, 0, block_view, block_length(block));
+
+    return block_view;
+}
+
+static void put_block_view(const void *data)
+{
+    if (data == block_view)
+    {
+        k_mutex_unlock(&block_view_lock);
+    }
+}
+
+static bool is_spooled(const struct pouch_gateway_uplink *uplink)
+{
+    return IS_ENABLED(CONFIG_POUCH_GATEWAY_SPOOL) && uplink->spooled;
+}
+
+static bool is_aggregating(const struct pouch_gateway_uplink *uplink)
+{
+    return IS_ENABLED(CONFIG_POUCH_GATEWAY_UPLINK_AGGREGATE) && uplink->aggregating;
+}
 
 static void process_uplink(struct pouch_gateway_uplink *uplink);
 
+/* The client is passed in once it exists, which may be after nodes are served */
+static bool cloud_is_connected(void)
+{
+    return client != NULL && golioth_client_is_connected(client);
+}
+
+/* Ends the downlink of an uplink that has no cloud session of its own */
+static void end_local_downlink(struct pouch_gateway_uplink *uplink, bool failed)
+{
+    if (uplink->downlink != NULL)
+    {
+        if (failed)
+        {
+            pouch_gateway_downlink_end_cb(GOLIOTH_ERR_FAIL, NULL, uplink->downlink);
+        }
+        else
+        {
+            pouch_gateway_downlink_block_cb(NULL, 0, true, uplink->downlink);
+        }
+    }
+}
+
+static void finish_spooled_uplink(struct pouch_gateway_uplink *uplink)
+{
+    bool failed = atomic_test_bit(uplink->flags, POUCH_UPLINK_FAILED);
+
+    if (failed)
+    {
+        spool_session_abort(uplink->spool_session);
+    }
+
+    /* The cloud won't answer a spooled uplink, so end the downlink here */
+    end_local_downlink(uplink, failed);
+
+    if (!failed && cloud_is_connected())
+    {
+        spool_drain(client);
+    }
+}
+
 static void cleanup_uplink(struct pouch_gateway_uplink *uplink)
 {
-    if (IS_ENABLED(CONFIG_POUCH_GATEWAY_CLOUD))
+    if (IS_ENABLED(CONFIG_POUCH_GATEWAY_UPLINK_AWAIT_CLOUD))
+    {
+        k_mutex_lock(&await_cloud_lock, K_FOREVER);
+        sys_slist_find_and_remove(&await_cloud_uplinks, &uplink->await_node);
+        k_mutex_unlock(&await_cloud_lock);
+    }
+
+    if (is_spooled(uplink))
+    {
+        finish_spooled_uplink(uplink);
+    }
+    else if (IS_ENABLED(CONFIG_POUCH_GATEWAY_CLOUD) && uplink->session != NULL)
     {
         golioth_gateway_uplink_finish(uplink->session);
     }
+    else if (uplink->aggregated || is_aggregating(uplink)
+             || atomic_test_bit(uplink->flags, POUCH_UPLINK_AWAIT_CLOUD))
+    {
+        /* The batch session drops downlink data, and an uplink that never
+           reached the cloud has none, nothing to wait for */
+        end_local_downlink(uplink, atomic_test_bit(uplink->flags, POUCH_UPLINK_FAILED));
+    }
+
+    struct block *block;
+    while ((block = block_queue_get(&uplink->queue)) != NULL)
+    {
+        block_free(block);
+    }
+
+    for (size_t i = 0; i < ARRAY_SIZE(uplink->inflight); i++)
+    {
+        if (uplink->inflight[i].block != NULL)
+        {
+            block_free(uplink->inflight[i].block);
+        }
+    }
+
+    if (uplink->wblock != NULL)
+    {
+        block_free(uplink->wblock);
+    }
+
+    LOG_DBG("Uplink used %zu fragments (%zu reserved), %zu allocations failed",
+            uplink->blocks.max_used,
+            uplink->blocks.reserved,
+            uplink->blocks.failed);
+
+    block_account_close(&uplink->blocks);
+    pouch_gateway_uplink_unref(uplink);
+
+    LOG_DBG("Block fragment usage: %zu (max %zu) of %d",
+            block_pool_used(),
+            block_pool_max_used(),
+            CONFIG_POUCH_GATEWAY_NUM_BLOCK_FRAGMENTS);
+}
+
+/* Must be called with uplink->lock held */
+static void release_slot(struct pouch_uplink_slot *slot)
+{
+    block_free(slot->block);
+    slot->block = NULL;
+    slot->uplink->inflight_count--;
+}
+
+static void fail_uplink(struct pouch_gateway_uplink *uplink, enum pouch_gateway_uplink_result res)
+{
+    if (atomic_test_and_set_bit(uplink->flags, POUCH_UPLINK_FAILED))
+    {
+        return;
+    }
 
-    sys_snode_t *n;
-    while ((n = sys_slist_get(&uplink->queue)) != NULL)
+    /* Blocks waiting for a retry are dropped right away. A retry that is
+       already running sees the failure once it gets the lock. */
+    for (size_t i = 0; i < ARRAY_SIZE(uplink->inflight); i++)
     {
-        free(CONTAINER_OF(n, struct pouch_block, node));
+        struct pouch_uplink_slot *slot = &uplink->inflight[i];
+
+        if (slot->retry_pending && 0 == k_work_cancel_delayable(&slot->retry_work))
+        {
+            slot->retry_pending = false;
+            release_slot(slot);
+        }
     }
 
-    free(uplink->wblock);
-    free(uplink->rblock);
-    free(uplink);
+    uplink->end_cb(uplink->cb_arg, res);
 }
 
+/* Must be called with uplink->lock held */
 static void block_upload_callback(struct golioth_client *client,
                                   enum golioth_status status,
                                   const struct golioth_coap_rsp_code *coap_rsp_code,
                                   const char *path,
                                   size_t block_size,
-                                  void *arg)
+                                  void *arg);
+
+/* Must be called with uplink->lock held */
+static enum golioth_status send_block(struct pouch_uplink_slot *slot)
+{
+    size_t len = block_length(slot->block);
+    const void *data = get_block_view(slot->block);
+
+    LOG_DBG("Sending block %u of size %zu", slot->idx, len);
+
+    enum golioth_status status = golioth_gateway_uplink_block(slot->uplink->session,
+                                                              slot->idx,
+                                                              data,
+                                                              len,
+                                                              slot->is_last,
+                                                              block_upload_callback,
+                                                              slot);
+
+    put_block_view(data);
+
+    return status;
+}
+
+/* Spooled blocks are written to flash on the spool work queue, so whoever
+   submitted them doesn't wait for the flash */
+static void spool_work_handler(struct k_work *work)
 {
-    struct pouch_gateway_uplink *uplink = arg;
+    struct pouch_uplink_slot *slot = CONTAINER_OF(work, struct pouch_uplink_slot, spool_work);
+    struct pouch_gateway_uplink *uplink = slot->uplink;
+    const void *data = get_block_view(slot->block);
+
+    /* An empty last block still marks the session as complete */
+    int err = spool_session_write(uplink->spool_session,
+                                  data,
+                                  block_length(slot->block),
+                                  slot->idx == 0,
+                                  slot->is_last);
+
+    put_block_view(data);
 
-    if (!atomic_test_and_clear_bit(uplink->flags, POUCH_UPLINK_SENDING))
+    k_mutex_lock(&uplink->lock, K_FOREVER);
+
+    if (err)
     {
-        LOG_ERR("Not sending");
-        return;
+        LOG_ERR("Failed to spool block: %d", err);
+        fail_uplink(uplink, POUCH_GATEWAY_UPLINK_ERROR_LOCAL);
     }
 
-    free(uplink->rblock);
-    uplink->rblock = NULL;
+    release_slot(slot);
 
-    if (status != GOLIOTH_OK)
+    k_mutex_unlock(&uplink->lock);
+
+    process_uplink(uplink);
+}
+
+/* Exponential backoff, starting at CONFIG_POUCH_GATEWAY_UPLINK_RETRY_BACKOFF_MIN */
+static uint32_t retry_delay_ms(uint8_t retries)
+{
+    uint32_t delay = CONFIG_POUCH_GATEWAY_UPLINK_RETRY_BACKOFF_MIN;
+
+    for (uint8_t i = 1; i < retries && delay < CONFIG_POUCH_GATEWAY_UPLINK_RETRY_BACKOFF_MAX; i++)
     {
-        LOG_ERR("Failed to deliver block: %d", status);
-        uplink->end_cb(uplink->end_cb_arg, POUCH_GATEWAY_UPLINK_ERROR_CLOUD);
-        cleanup_uplink(uplink);
-        return;
+        delay *= 2;
     }
 
-    process_uplink(uplink);
+    return MIN(delay, CONFIG_POUCH_GATEWAY_UPLINK_RETRY_BACKOFF_MAX);
 }
 
-static void process_uplink(struct pouch_gateway_uplink *uplink)
+/* Must be called with uplink->lock held. Returns false if the block is out
+   of retries, or the retry would miss the session deadline. */
+static bool schedule_retry(struct pouch_uplink_slot *slot)
+{
+    struct pouch_gateway_uplink *uplink = slot->uplink;
+
+    if (atomic_test_bit(uplink->flags, POUCH_UPLINK_FAILED)
+        || slot->retries >= CONFIG_POUCH_GATEWAY_UPLINK_BLOCK_RETRIES)
+    {
+        return false;
+    }
+
+    uint32_t delay = retry_delay_ms(slot->retries + 1);
+    if (uplink->deadline && k_uptime_get() + delay > uplink->deadline)
+    {
+        LOG_ERR("Uplink deadline reached");
+        return false;
+    }
+
+    slot->retries++;
+    slot->retry_pending = true;
+    k_work_reschedule(&slot->retry_work, K_MSEC(delay));
+
+    LOG_WRN("Retrying block %u in %u ms (retry %u)", slot->idx, delay, slot->retries);
+
+    return true;
+}
+
+static void retry_work_handler(struct k_work *work)
 {
-    enum golioth_status status;
-    if (atomic_test_and_set_bit(uplink->flags, POUCH_UPLINK_SENDING))
+    struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+    struct pouch_uplink_slot *slot = CONTAINER_OF(dwork, struct pouch_uplink_slot, retry_work);
+    struct pouch_gateway_uplink *uplink = slot->uplink;
+
+    k_mutex_lock(&uplink->lock, K_FOREVER);
+
+    if (!slot->retry_pending)
     {
-        LOG_DBG("Already processing queue");
+        k_mutex_unlock(&uplink->lock);
         return;
     }
 
-    bool closed = atomic_test_bit(uplink->flags, POUCH_UPLINK_CLOSED);
+    slot->retry_pending = false;
 
-    sys_snode_t *n = sys_slist_get(&uplink->queue);
-    if (n == NULL)
+    enum golioth_status status = GOLIOTH_ERR_FAIL;
+    if (!atomic_test_bit(uplink->flags, POUCH_UPLINK_FAILED))
     {
-        LOG_DBG("No blocks to process");
-        if (closed)
+        status = send_block(slot);
+        if (status == GOLIOTH_OK || schedule_retry(slot))
         {
-            uplink->end_cb(uplink->end_cb_arg, POUCH_GATEWAY_UPLINK_SUCCESS);
-            cleanup_uplink(uplink);
+            k_mutex_unlock(&uplink->lock);
+
+            /* New blocks were held back while the retry was pending */
+            process_uplink(uplink);
             return;
         }
 
-        atomic_clear_bit(uplink->flags, POUCH_UPLINK_SENDING);
-        return;
+        LOG_ERR("Failed to deliver block %u: %d", slot->idx, status);
+        fail_uplink(uplink, POUCH_GATEWAY_UPLINK_ERROR_CLOUD);
     }
 
-    uplink->rblock = CONTAINER_OF(n, struct pouch_block, node);
+    release_slot(slot);
 
-    LOG_DBG("Processing block %zu of size %zu", uplink->block_idx, uplink->rblock->len);
+    k_mutex_unlock(&uplink->lock);
 
-    if (!IS_ENABLED(CONFIG_POUCH_GATEWAY_CLOUD))
+    process_uplink(uplink);
+}
+
+static void block_upload_callback(struct golioth_client *client,
+                                  enum golioth_status status,
+                                  const struct golioth_coap_rsp_code *coap_rsp_code,
+                                  const char *path,
+                                  size_t block_size,
+                                  void *arg)
+{
+    struct pouch_uplink_slot *slot = arg;
+    struct pouch_gateway_uplink *uplink = slot->uplink;
+
+    k_mutex_lock(&uplink->lock, K_FOREVER);
+
+    /* The block stays in its slot until the cloud acknowledges it, so it
+       can be resent without involving the node */
+    if (status != GOLIOTH_OK && schedule_retry(slot))
     {
+        k_mutex_unlock(&uplink->lock);
         return;
     }
 
-    if (uplink->rblock->len == 0)
+    if (status != GOLIOTH_OK)
+    {
+        LOG_ERR("Failed to deliver block %u: %d", slot->idx, status);
+        fail_uplink(uplink, POUCH_GATEWAY_UPLINK_ERROR_CLOUD);
+    }
+
+    release_slot(slot);
+
+    k_mutex_unlock(&uplink->lock);
+
+    process_uplink(uplink);
+}
+
+/* Must be called with uplink->lock held */
+static bool retry_pending(const struct pouch_gateway_uplink *uplink)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(uplink->inflight); i++)
+    {
+        if (uplink->inflight[i].retry_pending)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Must be called with uplink->lock held */
+static struct pouch_uplink_slot *get_free_slot(struct pouch_gateway_uplink *uplink)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(uplink->inflight); i++)
+    {
+        if (uplink->inflight[i].block == NULL)
+        {
+            return &uplink->inflight[i];
+        }
+    }
+
+    return NULL;
+}
+
+static bool start_session(struct pouch_gateway_uplink *uplink)
+{
+    uplink->session = golioth_gateway_uplink_start(client,
+                                                   pouch_gateway_downlink_block_cb,
+                                                   pouch_gateway_downlink_end_cb,
+                                                   uplink->downlink);
+    if (uplink->session == NULL)
+    {
+        LOG_ERR("Failed to start blockwise upload");
+        return false;
+    }
+
+    return true;
+}
+
+#ifdef CONFIG_POUCH_GATEWAY_UPLINK_AGGREGATE
+
+static void aggregate_done(void *arg, enum aggregate_result result)
+{
+    struct pouch_uplink_slot *slot = arg;
+    struct pouch_gateway_uplink *uplink = slot->uplink;
+
+    k_mutex_lock(&uplink->lock, K_FOREVER);
+
+    if (result == AGGREGATE_UNACKNOWLEDGED && !atomic_test_bit(uplink->flags, POUCH_UPLINK_FAILED))
+    {
+        /* The pouch is still in its slot, so it goes out in a session of its
+           own. The slot is released once the cloud acknowledges it. */
+        if (start_session(uplink))
+        {
+            uplink->aggregated = false;
+
+            /* The acknowledgement may end the uplink before the lock is released */
+            pouch_gateway_uplink_ref(uplink);
+
+            if (GOLIOTH_OK == send_block(slot))
+            {
+                k_mutex_unlock(&uplink->lock);
+                pouch_gateway_uplink_unref(uplink);
+                return;
+            }
+
+            pouch_gateway_uplink_unref(uplink);
+        }
+
+        result = AGGREGATE_FAILED;
+    }
+
+    if (result == AGGREGATE_FAILED)
     {
-        LOG_WRN("Skipping zero length block");
+        fail_uplink(uplink, POUCH_GATEWAY_UPLINK_ERROR_CLOUD);
+    }
+
+    release_slot(slot);
 
-        free(uplink->rblock);
-        uplink->rblock = NULL;
-        atomic_clear_bit(uplink->flags, POUCH_UPLINK_SENDING);
+    k_mutex_unlock(&uplink->lock);
 
+    process_uplink(uplink);
+}
+
+/* Decides whether the uplink goes into a shared batch, or needs a session of
+   its own after all. Must be called with uplink->lock held. */
+static void aggregate_uplink(struct pouch_gateway_uplink *uplink)
+{
+    bool closed = atomic_test_bit(uplink->flags, POUCH_UPLINK_CLOSED);
+    struct block *block = block_queue_peek(&uplink->queue);
+
+    if (!closed)
+    {
+        if (block == NULL && uplink->wblock != NULL
+            && block_length(uplink->wblock) <= CONFIG_POUCH_GATEWAY_UPLINK_AGGREGATE_MAX_POUCH)
+        {
+            /* Still small enough, keep collecting */
+            return;
+        }
+    }
+    else if (uplink->queue_len == 1 && block_length(block) == 0)
+    {
+        uplink->aggregating = false;
+        uplink->aggregated = true;
         return;
     }
+    else if (uplink->queue_len == 1)
+    {
+        struct pouch_uplink_slot *slot = get_free_slot(uplink);
 
-    status = golioth_gateway_uplink_block(uplink->session,
-                                          uplink->block_idx++,
-                                          uplink->rblock->data,
-                                          uplink->rblock->len,
-                                          sys_slist_is_empty(&uplink->queue) && closed,
-                                          block_upload_callback,
-                                          uplink);
-    if (status != GOLIOTH_OK)
+        /* aggregate_done() needs the lock, so it waits until the block is in its slot */
+        if (0 == aggregate_submit(block, aggregate_done, slot))
+        {
+            slot->block = block_queue_get(&uplink->queue);
+            slot->idx = 0;
+            slot->retries = 0;
+            slot->retry_pending = false;
+            slot->is_last = true;
+            uplink->queue_len--;
+            uplink->inflight_count++;
+
+            uplink->aggregating = false;
+            uplink->aggregated = true;
+            return;
+        }
+    }
+
+    uplink->aggregating = false;
+
+    if (!start_session(uplink))
     {
-        LOG_ERR("Failed to deliver block: %d", status);
-        uplink->end_cb(uplink->end_cb_arg, POUCH_GATEWAY_UPLINK_ERROR_LOCAL);
-        cleanup_uplink(uplink);
+        fail_uplink(uplink, POUCH_GATEWAY_UPLINK_ERROR_CLOUD);
     }
 }
 
-static struct pouch_block *block_alloc(struct pouch_gateway_uplink *uplink)
+#endif /* CONFIG_POUCH_GATEWAY_UPLINK_AGGREGATE */
+
+static void process_uplink(struct pouch_gateway_uplink *uplink)
 {
-    struct pouch_block *block = malloc(sizeof(struct pouch_block));
-    if (block == NULL)
+    k_mutex_lock(&uplink->lock, K_FOREVER);
+
+    bool held = atomic_test_bit(uplink->flags, POUCH_UPLINK_HELD)
+        || atomic_test_bit(uplink->flags, POUCH_UPLINK_AWAIT_CLOUD);
+
+#ifdef CONFIG_POUCH_GATEWAY_UPLINK_AGGREGATE
+    if (is_aggregating(uplink) && !held && !atomic_test_bit(uplink->flags, POUCH_UPLINK_FAILED))
     {
-        LOG_ERR("Failed to alloc block");
-        return NULL;
+        aggregate_uplink(uplink);
+    }
+#endif
+
+    bool closed = atomic_test_bit(uplink->flags, POUCH_UPLINK_CLOSED);
+
+    while (!atomic_test_bit(uplink->flags, POUCH_UPLINK_FAILED) && !held
+           && !is_aggregating(uplink) && uplink->inflight_count < ARRAY_SIZE(uplink->inflight))
+    {
+        if (sys_slist_is_empty(&uplink->queue))
+        {
+            LOG_DBG("No blocks to process");
+            break;
+        }
+
+        if (is_spooled(uplink) && uplink->inflight_count > 0)
+        {
+            /* Spooled blocks are written one at a time to keep them in order */
+            break;
+        }
+
+        if (retry_pending(uplink))
+        {
+            /* Blocks carry their index, so a retried block may arrive after
+               later ones. Holding back new blocks until the retry is sent
+               limits that to the blocks already in flight. */
+            break;
+        }
+
+        bool is_last = closed && sys_slist_peek_head(&uplink->queue)
+                                     == sys_slist_peek_tail(&uplink->queue);
+        if (is_last && uplink->inflight_count > 0)
+        {
+            /* The last block completes the upload, so it is sent only after
+               all preceding blocks have been acknowledged. */
+            break;
+        }
+
+        struct block *block = block_queue_get(&uplink->queue);
+        uplink->queue_len--;
+
+        if (is_spooled(uplink))
+        {
+            struct pouch_uplink_slot *slot = get_free_slot(uplink);
+
+            slot->block = block;
+            slot->idx = uplink->block_idx++;
+            slot->is_last = is_last;
+            uplink->inflight_count++;
+
+            spool_submit(&slot->spool_work);
+            continue;
+        }
+
+        if (block_length(block) == 0)
+        {
+            LOG_WRN("Skipping zero length block");
+            block_free(block);
+            continue;
+        }
+
+        if (!IS_ENABLED(CONFIG_POUCH_GATEWAY_CLOUD))
+        {
+            LOG_DBG("Dropping block %u of size %zu", uplink->block_idx++, block_length(block));
+            block_free(block);
+            continue;
+        }
+
+        struct pouch_uplink_slot *slot = get_free_slot(uplink);
+
+        slot->block = block;
+        slot->idx = uplink->block_idx++;
+        slot->retries = 0;
+        slot->retry_pending = false;
+        slot->is_last = is_last;
+        uplink->inflight_count++;
+
+        enum golioth_status status = send_block(slot);
+        if (status != GOLIOTH_OK)
+        {
+            LOG_ERR("Failed to deliver block: %d", status);
+            release_slot(slot);
+            fail_uplink(uplink, POUCH_GATEWAY_UPLINK_ERROR_LOCAL);
+        }
+    }
+
+    bool failed = atomic_test_bit(uplink->flags, POUCH_UPLINK_FAILED);
+    bool done = uplink->inflight_count == 0
+        && (failed || (closed && uplink->wblock == NULL && sys_slist_is_empty(&uplink->queue)))
+        && !atomic_test_and_set_bit(uplink->flags, POUCH_UPLINK_DONE);
+    bool resume = !failed && !done
+        && uplink->queue_len + uplink->inflight_count <= CONFIG_POUCH_GATEWAY_UPLINK_LOW_WATERMARK
+        && atomic_test_and_clear_bit(uplink->flags, POUCH_UPLINK_THROTTLED);
+
+    /* Callbacks may be replaced once the lock is released */
+    pouch_gateway_uplink_end_cb end_cb = uplink->end_cb;
+    pouch_gateway_uplink_resume_cb resume_cb = uplink->resume_cb;
+    void *cb_arg = uplink->cb_arg;
+
+    k_mutex_unlock(&uplink->lock);
+
+    if (resume)
+    {
+        LOG_DBG("Uplink below low watermark, resuming");
+        resume_cb(cb_arg);
     }
 
-    block->len = 0;
+    if (done)
+    {
+        if (!failed)
+        {
+            end_cb(cb_arg, POUCH_GATEWAY_UPLINK_SUCCESS);
+        }
 
-    return block;
+        cleanup_uplink(uplink);
+    }
 }
 
 static void submit_block(struct pouch_gateway_uplink *uplink)
 {
-    LOG_DBG("Submitting block of size %zu", uplink->wblock->len);
-    sys_slist_append(&uplink->queue, &uplink->wblock->node);
+    LOG_DBG("Submitting block of size %zu", block_length(uplink->wblock));
+    block_queue_append(&uplink->queue, uplink->wblock);
+    uplink->queue_len++;
     uplink->wblock = NULL;
+
+    if (uplink->queue_len + uplink->inflight_count >= CONFIG_POUCH_GATEWAY_UPLINK_HIGH_WATERMARK
+        && !atomic_test_and_set_bit(uplink->flags, POUCH_UPLINK_THROTTLED))
+    {
+        LOG_DBG("Uplink above high watermark, throttling");
+    }
 }
 
 int pouch_gateway_uplink_write(struct pouch_gateway_uplink *uplink,
@@ -180,32 +714,47 @@ int pouch_gateway_uplink_write(struct pouch_gateway_uplink *uplink,
                                size_t len,
                                bool is_last)
 {
+    if (atomic_test_bit(uplink->flags, POUCH_UPLINK_FAILED))
+    {
+        return -EIO;
+    }
+
+    k_mutex_lock(&uplink->lock, K_FOREVER);
+
     while (len)
     {
-        if (uplink->wblock != NULL && uplink->wblock->len == sizeof(uplink->wblock->data))
+        if (uplink->wblock != NULL && block_space(uplink->wblock) == 0)
         {
             submit_block(uplink);
         }
 
         if (uplink->wblock == NULL)
         {
-            uplink->wblock = block_alloc(uplink);
+            uplink->wblock = block_alloc(&uplink->blocks);
             if (uplink->wblock == NULL)
             {
                 LOG_ERR("Failed to alloc new block");
+                k_mutex_unlock(&uplink->lock);
                 return -ENOMEM;
             }
         }
 
-        size_t bytes_to_copy = MIN(len, sizeof(uplink->wblock->data) - uplink->wblock->len);
+        size_t bytes_to_copy = MIN(len, block_space(uplink->wblock));
 
-        memcpy(&uplink->wblock->data[uplink->wblock->len], payload, bytes_to_copy);
-        uplink->wblock->len += bytes_to_copy;
+        int err = block_append(uplink->wblock, payload, bytes_to_copy);
+        if (err)
+        {
+            LOG_ERR("Failed to append to block: %d", err);
+            k_mutex_unlock(&uplink->lock);
+            return err;
+        }
 
         len -= bytes_to_copy;
         payload += bytes_to_copy;
     }
 
+    k_mutex_unlock(&uplink->lock);
+
     if (is_last)
     {
         pouch_gateway_uplink_close(uplink);
@@ -221,53 +770,221 @@ int pouch_gateway_uplink_write(struct pouch_gateway_uplink *uplink,
 void pouch_gateway_uplink_module_init(struct golioth_client *c)
 {
     client = c;
+
+    if (IS_ENABLED(CONFIG_POUCH_GATEWAY_UPLINK_AGGREGATE))
+    {
+        aggregate_init(client);
+    }
+
+    if (IS_ENABLED(CONFIG_POUCH_GATEWAY_SPOOL))
+    {
+        int err = spool_init();
+        if (err)
+        {
+            LOG_ERR("Failed to init spool: %d", err);
+        }
+
+        spool_ready = (err == 0);
+    }
+}
+
+static int64_t uplink_deadline(void)
+{
+    return CONFIG_POUCH_GATEWAY_UPLINK_DEADLINE
+        ? k_uptime_get() + CONFIG_POUCH_GATEWAY_UPLINK_DEADLINE * MSEC_PER_SEC
+        : 0;
+}
+
+/* Sends the uplinks that were held while the cloud wasn't connected */
+static void release_await_cloud_uplinks(void)
+{
+    k_mutex_lock(&await_cloud_lock, K_FOREVER);
+
+    sys_snode_t *node;
+    while (NULL != (node = sys_slist_get(&await_cloud_uplinks)))
+    {
+        struct pouch_gateway_uplink *uplink =
+            CONTAINER_OF(node, struct pouch_gateway_uplink, await_node);
+
+        k_mutex_lock(&uplink->lock, K_FOREVER);
+
+        if (IS_ENABLED(CONFIG_POUCH_GATEWAY_UPLINK_AGGREGATE))
+        {
+            uplink->aggregating = true;
+        }
+        else if (!start_session(uplink))
+        {
+            fail_uplink(uplink, POUCH_GATEWAY_UPLINK_ERROR_CLOUD);
+        }
+
+        if (!atomic_test_bit(uplink->flags, POUCH_UPLINK_FAILED))
+        {
+            atomic_clear_bit(uplink->flags, POUCH_UPLINK_AWAIT_CLOUD);
+        }
+
+        uplink->deadline = uplink_deadline();
+
+        k_mutex_unlock(&uplink->lock);
+
+        /* Still under await_cloud_lock, which keeps the uplink from being
+           freed by another thread in the meantime */
+        process_uplink(uplink);
+    }
+
+    k_mutex_unlock(&await_cloud_lock);
+}
+
+void pouch_gateway_uplink_module_on_connected(struct golioth_client *c)
+{
+    client = c;
+
+    if (IS_ENABLED(CONFIG_POUCH_GATEWAY_UPLINK_AGGREGATE))
+    {
+        aggregate_init(client);
+    }
+
+    if (IS_ENABLED(CONFIG_POUCH_GATEWAY_UPLINK_AWAIT_CLOUD))
+    {
+        release_await_cloud_uplinks();
+    }
+
+    if (IS_ENABLED(CONFIG_POUCH_GATEWAY_SPOOL) && spool_ready)
+    {
+        spool_drain(client);
+    }
+}
+
+bool pouch_gateway_uplink_can_spool(void)
+{
+    return IS_ENABLED(CONFIG_POUCH_GATEWAY_SPOOL) && spool_ready;
+}
+
+bool pouch_gateway_uplink_can_buffer(void)
+{
+    return IS_ENABLED(CONFIG_POUCH_GATEWAY_UPLINK_AWAIT_CLOUD) || pouch_gateway_uplink_can_spool();
+}
+
+bool pouch_gateway_uplink_is_throttled(const struct pouch_gateway_uplink *uplink)
+{
+    return atomic_test_bit(uplink->flags, POUCH_UPLINK_THROTTLED);
 }
 
 struct pouch_gateway_uplink *pouch_gateway_uplink_open(
     struct pouch_gateway_downlink_context *downlink,
     pouch_gateway_uplink_end_cb end_cb,
-    void *end_cb_arg)
+    pouch_gateway_uplink_resume_cb resume_cb,
+    void *cb_arg)
 {
-    struct pouch_gateway_uplink *uplink = malloc(sizeof(struct pouch_gateway_uplink));
-    if (uplink == NULL)
+    struct pouch_gateway_uplink *uplink = NULL;
+    int err = k_mem_slab_alloc(&uplink_slab, (void **) &uplink, K_NO_WAIT);
+    if (err)
     {
+        LOG_ERR("Too many open uplinks");
         return NULL;
     }
 
-    uplink->wblock = block_alloc(uplink);
+    block_account_open(&uplink->blocks, CONFIG_POUCH_GATEWAY_UPLINK_BLOCK_WEIGHT);
+
+    uplink->wblock = block_alloc(&uplink->blocks);
     if (uplink->wblock == NULL)
     {
-        free(uplink);
+        LOG_ERR("Failed to alloc block");
+        block_account_close(&uplink->blocks);
+        k_mem_slab_free(&uplink_slab, uplink);
         return NULL;
     }
 
-    if (IS_ENABLED(CONFIG_POUCH_GATEWAY_CLOUD))
+    uplink->session = NULL;
+    uplink->downlink = downlink;
+    uplink->spooled = false;
+    uplink->aggregating = false;
+    uplink->aggregated = false;
+
+    bool await_cloud = false;
+
+    /* Keeps the cloud from connecting between the check and the uplink
+       being added to await_cloud_uplinks */
+    k_mutex_lock(&await_cloud_lock, K_FOREVER);
+
+    if (IS_ENABLED(CONFIG_POUCH_GATEWAY_UPLINK_AGGREGATE) && cloud_is_connected())
     {
-        uplink->session = golioth_gateway_uplink_start(client,
-                                                       pouch_gateway_downlink_block_cb,
-                                                       pouch_gateway_downlink_end_cb,
-                                                       downlink);
-        if (uplink->session == NULL)
-        {
-            LOG_ERR("Failed to start blockwise upload");
-            free(uplink->wblock);
-            free(uplink);
-            return NULL;
-        }
+        /* The session is started once the pouch turns out too large to share one */
+        uplink->aggregating = true;
+    }
+    else if (IS_ENABLED(CONFIG_POUCH_GATEWAY_CLOUD) && client != NULL
+             && (golioth_client_is_connected(client)
+                 || (!spool_ready && !IS_ENABLED(CONFIG_POUCH_GATEWAY_UPLINK_AWAIT_CLOUD))))
+    {
+        start_session(uplink);
+    }
+
+    if (IS_ENABLED(CONFIG_POUCH_GATEWAY_SPOOL) && spool_ready && uplink->session == NULL
+        && !uplink->aggregating)
+    {
+        uplink->spooled = true;
+        uplink->spool_session = spool_session_open();
+
+        LOG_INF("Cloud unreachable, spooling uplink as session %u", uplink->spool_session);
+    }
+    else if (IS_ENABLED(CONFIG_POUCH_GATEWAY_UPLINK_AWAIT_CLOUD) && uplink->session == NULL
+             && !uplink->aggregating && !cloud_is_connected())
+    {
+        LOG_INF("Cloud not connected, holding uplink until it is");
+        await_cloud = true;
+    }
+    else if (IS_ENABLED(CONFIG_POUCH_GATEWAY_CLOUD) && uplink->session == NULL
+             && !uplink->aggregating)
+    {
+        k_mutex_unlock(&await_cloud_lock);
+        block_free(uplink->wblock);
+        block_account_close(&uplink->blocks);
+        k_mem_slab_free(&uplink_slab, uplink);
+        return NULL;
     }
 
-    uplink->rblock = NULL;
+    k_mutex_init(&uplink->lock);
+    atomic_set(&uplink->refs, 1);
     uplink->block_idx = 0;
     atomic_set(uplink->flags, 0);
     sys_slist_init(&uplink->queue);
+    uplink->queue_len = 0;
+    for (size_t i = 0; i < ARRAY_SIZE(uplink->inflight); i++)
+    {
+        uplink->inflight[i].uplink = uplink;
+        uplink->inflight[i].block = NULL;
+        uplink->inflight[i].retry_pending = false;
+        k_work_init_delayable(&uplink->inflight[i].retry_work, retry_work_handler);
+        if (IS_ENABLED(CONFIG_POUCH_GATEWAY_SPOOL))
+        {
+            k_work_init(&uplink->inflight[i].spool_work, spool_work_handler);
+        }
+    }
+    uplink->inflight_count = 0;
+    uplink->deadline = uplink_deadline();
     uplink->end_cb = end_cb;
-    uplink->end_cb_arg = end_cb_arg;
+    uplink->resume_cb = resume_cb;
+    uplink->cb_arg = cb_arg;
+
+    if (await_cloud)
+    {
+        atomic_set_bit(uplink->flags, POUCH_UPLINK_AWAIT_CLOUD);
+        sys_slist_append(&await_cloud_uplinks, &uplink->await_node);
+    }
+
+    k_mutex_unlock(&await_cloud_lock);
 
     return uplink;
 }
 
 void pouch_gateway_uplink_close(struct pouch_gateway_uplink *uplink)
 {
+    if (uplink == NULL)
+    {
+        return;
+    }
+
+    k_mutex_lock(&uplink->lock, K_FOREVER);
+
     bool closed = atomic_test_and_set_bit(uplink->flags, POUCH_UPLINK_CLOSED);
 
     if (!closed && uplink->wblock != NULL)
@@ -275,5 +992,66 @@ void pouch_gateway_uplink_close(struct pouch_gateway_uplink *uplink)
         submit_block(uplink);
     }
 
+    k_mutex_unlock(&uplink->lock);
+
     process_uplink(uplink);
 }
+
+void pouch_gateway_uplink_abort(struct pouch_gateway_uplink *uplink)
+{
+    k_mutex_lock(&uplink->lock, K_FOREVER);
+
+    /* Only reachable through a reference once the uplink has ended */
+    bool done = atomic_test_bit(uplink->flags, POUCH_UPLINK_DONE);
+    if (!done)
+    {
+        fail_uplink(uplink, POUCH_GATEWAY_UPLINK_ERROR_LOCAL);
+    }
+
+    k_mutex_unlock(&uplink->lock);
+
+    if (!done)
+    {
+        process_uplink(uplink);
+    }
+}
+
+void pouch_gateway_uplink_ref(struct pouch_gateway_uplink *uplink)
+{
+    atomic_inc(&uplink->refs);
+}
+
+void pouch_gateway_uplink_unref(struct pouch_gateway_uplink *uplink)
+{
+    if (atomic_dec(&uplink->refs) == 1)
+    {
+        k_mem_slab_free(&uplink_slab, uplink);
+    }
+}
+
+void pouch_gateway_uplink_set_callbacks(struct pouch_gateway_uplink *uplink,
+                                        pouch_gateway_uplink_end_cb end_cb,
+                                        pouch_gateway_uplink_resume_cb resume_cb,
+                                        void *cb_arg)
+{
+    k_mutex_lock(&uplink->lock, K_FOREVER);
+
+    uplink->end_cb = end_cb;
+    uplink->resume_cb = resume_cb;
+    uplink->cb_arg = cb_arg;
+
+    k_mutex_unlock(&uplink->lock);
+}
+
+void pouch_gateway_uplink_hold(struct pouch_gateway_uplink *uplink)
+{
+    atomic_set_bit(uplink->flags, POUCH_UPLINK_HELD);
+}
+
+void pouch_gateway_uplink_release(struct pouch_gateway_uplink *uplink)
+{
+    if (atomic_test_and_clear_bit(uplink->flags, POUCH_UPLINK_HELD))
+    {
+        process_uplink(uplink);
+    }
+}
@@ -185,6 +185,8 @@ int main(void)
 
     k_work_init_delayable(&sync_data.work, sync_start_handler);
 
+    pouch_gateway_cert_module_init();
+
     connect_to_cloud();
 
     pouch_gateway_cert_module_on_connected(client);
@@ -0,0 +1,30 @@
+/*
+ * Copyright (c) 2025 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#include <golioth/client.h>
+
+/* Estimated bytes on the cellular link for each block request and its
+   acknowledgement: IPv4 and UDP headers, a DTLS 1.2 record with an AES-CCM
+   tag, and the CoAP header, token and options of a blockwise upload */
+#define FAKE_CLOUD_REQUEST_OVERHEAD (20 + 8 + 29 + 30)
+#define FAKE_CLOUD_RESPONSE_LEN (20 + 8 + 29 + 15)
+
+struct fake_cloud_stats
+{
+    size_t sessions;
+    size_t messages;
+    size_t payload_bytes;
+};
+
+/* Passed to the uplink module in place of a connected client */
+extern struct golioth_client *const fake_cloud_client;
+
+void fake_cloud_reset(void);
+void fake_cloud_stats_get(struct fake_cloud_stats *stats);
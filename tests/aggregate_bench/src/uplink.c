@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2025 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/sys/atomic.h>
+#include <zephyr/ztest.h>
+
+#include <pouch_gateway/uplink.h>
+
+#include "block.h"
+#include "cloud.h"
+
+#define BENCH_ROUNDS 4
+#define BENCH_NODES CONFIG_POUCH_GATEWAY_UPLINK_MAX_SESSIONS
+
+static uint8_t payload[CONFIG_GOLIOTH_BLOCKWISE_UPLOAD_MAX_BLOCK_SIZE];
+
+static atomic_t ended;
+static atomic_t failed;
+
+static void end_cb(void *arg, enum pouch_gateway_uplink_result res)
+{
+    if (res != POUCH_GATEWAY_UPLINK_SUCCESS)
+    {
+        atomic_inc(&failed);
+    }
+
+    atomic_inc(&ended);
+}
+
+static void resume_cb(void *arg) {}
+
+static bool wait_ended(size_t count)
+{
+    /* Simulated time, batches wait up to their latency */
+    for (int i = 0; i < 1000 && atomic_get(&ended) < count; i++)
+    {
+        k_sleep(K_MSEC(10));
+    }
+
+    return atomic_get(&ended) == count;
+}
+
+/* Every node delivers one pouch per round, as they do when woken up
+   together. Reports what the cellular link carries per pouch. */
+static void bench_pouches(size_t len)
+{
+    size_t pouches = BENCH_ROUNDS * BENCH_NODES;
+    struct fake_cloud_stats stats;
+
+    fake_cloud_reset();
+    atomic_clear(&ended);
+    atomic_clear(&failed);
+
+    for (int round = 0; round < BENCH_ROUNDS; round++)
+    {
+        struct pouch_gateway_uplink *uplinks[BENCH_NODES];
+
+        for (int i = 0; i < BENCH_NODES; i++)
+        {
+            uplinks[i] = pouch_gateway_uplink_open(NULL, end_cb, resume_cb, NULL);
+            zassert_not_null(uplinks[i]);
+        }
+
+        for (int i = 0; i < BENCH_NODES; i++)
+        {
+            zassert_ok(pouch_gateway_uplink_write(uplinks[i], payload, len, true));
+        }
+
+        zassert_true(wait_ended((round + 1) * BENCH_NODES));
+    }
+
+    zassert_equal(atomic_get(&failed), 0);
+    zassert_equal(block_pool_used(), 0);
+
+    fake_cloud_stats_get(&stats);
+
+    size_t link_bytes = stats.payload_bytes
+        + stats.messages * (FAKE_CLOUD_REQUEST_OVERHEAD + FAKE_CLOUD_RESPONSE_LEN);
+
+    TC_PRINT("%zu %zu byte pouches: %zu sessions, %zu messages, %zu payload bytes, "
+             "%zu link bytes (%zu per pouch)\n",
+             pouches,
+             len,
+             stats.sessions,
+             stats.messages,
+             stats.payload_bytes,
+             link_bytes,
+             link_bytes / pouches);
+
+    zassert_true(stats.payload_bytes >= pouches * len);
+
+#ifdef CONFIG_POUCH_GATEWAY_UPLINK_AGGREGATE
+    if (len <= CONFIG_POUCH_GATEWAY_UPLINK_AGGREGATE_MAX_POUCH)
+    {
+        zassert_true(stats.messages < pouches, "Pouches weren't batched");
+        return;
+    }
+#endif
+
+    /* Each pouch fits a single block */
+    zassert_equal(stats.messages, pouches);
+}
+
+ZTEST(aggregate_bench, test_tiny_pouches)
+{
+    bench_pouches(16);
+}
+
+ZTEST(aggregate_bench, test_small_pouches)
+{
+    bench_pouches(64);
+}
+
+/* Too large to share a batch, costs the same either way */
+ZTEST(aggregate_bench, test_large_pouches)
+{
+    bench_pouches(sizeof(payload));
+}
+
+static void *aggregate_bench_setup(void)
+{
+    for (size_t i = 0; i < sizeof(payload); i++)
+    {
+        payload[i] = i;
+    }
+
+    pouch_gateway_uplink_module_init(fake_cloud_client);
+
+    return NULL;
+}
+
+ZTEST_SUITE(aggregate_bench, NULL, aggregate_bench_setup, NULL, NULL, NULL);
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2025 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include <zephyr/ztest.h>
+
+#include <pouch_gateway/uplink.h>
+
+#include "block.h"
+
+struct uplink_state
+{
+    int ended;
+    enum pouch_gateway_uplink_result res;
+};
+
+static uint8_t payload[CONFIG_GOLIOTH_BLOCKWISE_UPLOAD_MAX_BLOCK_SIZE + 100];
+
+static void end_cb(void *arg, enum pouch_gateway_uplink_result res)
+{
+    struct uplink_state *state = arg;
+
+    state->ended++;
+    state->res = res;
+}
+
+static void resume_cb(void *arg) {}
+
+static struct pouch_gateway_uplink *open_uplink(struct uplink_state *state)
+{
+    memset(state, 0, sizeof(*state));
+
+    return pouch_gateway_uplink_open(NULL, end_cb, resume_cb, state);
+}
+
+ZTEST(uplink_no_cloud, test_last_write_completes)
+{
+    struct uplink_state state;
+    struct pouch_gateway_uplink *uplink = open_uplink(&state);
+    zassert_not_null(uplink);
+
+    zassert_ok(pouch_gateway_uplink_write(uplink, payload, sizeof(payload), true));
+
+    /* Without a cloud, the uplink is dropped before the last write returns */
+    zassert_equal(state.ended, 1);
+    zassert_equal(state.res, POUCH_GATEWAY_UPLINK_SUCCESS);
+    zassert_equal(block_pool_used(), 0);
+}
+
+ZTEST(uplink_no_cloud, test_close_null)
+{
+    pouch_gateway_uplink_close(NULL);
+}
+
+ZTEST(uplink_no_cloud, test_close_completes)
+{
+    struct uplink_state state;
+    struct pouch_gateway_uplink *uplink = open_uplink(&state);
+    zassert_not_null(uplink);
+
+    zassert_ok(pouch_gateway_uplink_write(uplink, payload, 10, false));
+    zassert_equal(state.ended, 0);
+
+    pouch_gateway_uplink_close(uplink);
+
+    zassert_equal(state.ended, 1);
+    zassert_equal(state.res, POUCH_GATEWAY_UPLINK_SUCCESS);
+    zassert_equal(block_pool_used(), 0);
+}
+
+ZTEST(uplink_no_cloud, test_abort)
+{
+    struct uplink_state state;
+    struct pouch_gateway_uplink *uplink = open_uplink(&state);
+    zassert_not_null(uplink);
+
+    zassert_ok(pouch_gateway_uplink_write(uplink, payload, 10, false));
+
+    pouch_gateway_uplink_abort(uplink);
+
+    zassert_equal(state.ended, 1);
+    zassert_equal(state.res, POUCH_GATEWAY_UPLINK_ERROR_LOCAL);
+    zassert_equal(block_pool_used(), 0);
+}
+
+ZTEST(uplink_no_cloud, test_no_leak)
+{
+    /* Every completed uplink must return its context, or opening runs out */
+    for (int i = 0; i < 4 * CONFIG_POUCH_GATEWAY_UPLINK_MAX_SESSIONS; i++)
+    {
+        struct uplink_state state;
+        struct pouch_gateway_uplink *uplink = open_uplink(&state);
+        zassert_not_null(uplink, "Open failed after %d uplinks", i);
+
+        zassert_ok(pouch_gateway_uplink_write(uplink, payload, sizeof(payload), true));
+        zassert_equal(state.ended, 1);
+    }
+}
+
+static void *uplink_setup(void)
+{
+    for (size_t i = 0; i < sizeof(payload); i++)
+    {
+        payload[i] = i;
+    }
+
+    pouch_gateway_uplink_module_init(NULL);
+
+    return NULL;
+}
+
+ZTEST_SUITE(uplink_no_cloud, NULL, uplink_setup, NULL, NULL, NULL);
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2025 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+
+#include <golioth/gateway.h>
+#include <pouch_gateway/downlink.h>
+
+#include "cloud.h"
+#include "spool.h"
+
+struct fake_cloud_session fake_cloud_sessions[FAKE_CLOUD_MAX_SESSIONS];
+
+static char client_placeholder;
+struct golioth_client *const fake_cloud_client = (struct golioth_client *) &client_placeholder;
+
+bool fake_cloud_connected;
+
+static size_t started;
+static atomic_t finished;
+static enum golioth_status fail_status;
+static struct golioth_coap_rsp_code fail_code;
+
+static K_SEM_DEFINE(flushed, 0, 1);
+
+static void flush_handler(struct k_work *work)
+{
+    k_sem_give(&flushed);
+}
+
+static K_WORK_DEFINE(flush_work, flush_handler);
+
+/* Batch sessions get an empty downlink, like from a cloud that stores the
+   batch without splitting it. Only one batch is sent at a time. */
+static void (*batch_end_cb)(enum golioth_status status,
+                            const struct golioth_coap_rsp_code *coap_rsp_code,
+                            void *arg);
+static void *batch_arg;
+static struct gateway_uplink *batch_session;
+
+static void batch_end_handler(struct k_work *work)
+{
+    batch_end_cb(GOLIOTH_OK, NULL, batch_arg);
+}
+
+static K_WORK_DEFINE(batch_end_work, batch_end_handler);
+
+void fake_cloud_reset(void)
+{
+    memset(fake_cloud_sessions, 0, sizeof(fake_cloud_sessions));
+    started = 0;
+    atomic_clear(&finished);
+    fail_status = GOLIOTH_OK;
+    fake_cloud_connected = false;
+}
+
+void fake_cloud_fail(enum golioth_status status, uint8_t code_class, uint8_t code_detail)
+{
+    fail_status = status;
+    fail_code.code_class = code_class;
+    fail_code.code_detail = code_detail;
+}
+
+size_t fake_cloud_finished(void)
+{
+    return atomic_get(&finished);
+}
+
+bool fake_cloud_wait(size_t sessions)
+{
+    for (int i = 0; i < 1000 && fake_cloud_finished() < sessions; i++)
+    {
+        k_sleep(K_MSEC(10));
+    }
+
+    if (fake_cloud_finished() < sessions)
+    {
+        return false;
+    }
+
+    /* The spool stores the completion right after finishing the upload, in
+       the same work item, so a work item submitted now runs after it */
+    k_sem_reset(&flushed);
+    spool_submit(&flush_work);
+
+    return 0 == k_sem_take(&flushed, K_SECONDS(10));
+}
+
+bool __wrap_golioth_client_is_connected(struct golioth_client *client)
+{
+    return fake_cloud_connected;
+}
+
+struct gateway_uplink *__wrap_golioth_gateway_uplink_start(
+    struct golioth_client *client,
+    enum golioth_status (*block_cb)(const uint8_t *data, size_t len, bool is_last, void *arg),
+    void (*end_cb)(enum golioth_status status,
+                   const struct golioth_coap_rsp_code *coap_rsp_code,
+                   void *arg),
+    void *arg)
+{
+    if (started >= FAKE_CLOUD_MAX_SESSIONS)
+    {
+        /* Older sessions are only kept for inspection */
+        started = 0;
+    }
+
+    struct fake_cloud_session *session = &fake_cloud_sessions[started++];
+
+    session->len = 0;
+    session->finished = false;
+
+    if (block_cb != pouch_gateway_downlink_block_cb)
+    {
+        batch_end_cb = end_cb;
+        batch_arg = arg;
+        batch_session = (struct gateway_uplink *) session;
+    }
+
+    return (struct gateway_uplink *) session;
+}
+
+enum golioth_status __wrap_golioth_gateway_uplink_block(
+    struct gateway_uplink *uplink,
+    uint32_t block_idx,
+    const uint8_t *buf,
+    size_t buf_len,
+    bool is_last,
+    void (*set_cb)(struct golioth_client *client,
+                   enum golioth_status status,
+                   const struct golioth_coap_rsp_code *coap_rsp_code,
+                   const char *path,
+                   size_t block_size,
+                   void *arg),
+    void *arg)
+{
+    struct fake_cloud_session *session = (struct fake_cloud_session *) uplink;
+
+    if (fail_status != GOLIOTH_OK)
+    {
+        set_cb(fake_cloud_client, fail_status, &fail_code, NULL, 0, arg);
+        return GOLIOTH_OK;
+    }
+
+    if (session->len + buf_len > sizeof(session->data))
+    {
+        return GOLIOTH_ERR_MEM_ALLOC;
+    }
+
+    memcpy(&session->data[session->len], buf, buf_len);
+    session->len += buf_len;
+
+    set_cb(fake_cloud_client, GOLIOTH_OK, NULL, NULL, buf_len, arg);
+
+    return GOLIOTH_OK;
+}
+
+void __wrap_golioth_gateway_uplink_finish(struct gateway_uplink *uplink)
+{
+    struct fake_cloud_session *session = (struct fake_cloud_session *) uplink;
+
+    session->finished = true;
+    atomic_inc(&finished);
+
+    if (uplink == batch_session)
+    {
+        batch_session = NULL;
+        k_work_submit(&batch_end_work);
+    }
+}
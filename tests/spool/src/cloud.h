@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2025 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <golioth/client.h>
+
+#define FAKE_CLOUD_MAX_SESSIONS 4
+#define FAKE_CLOUD_MAX_SESSION_LEN 4096
+
+struct fake_cloud_session
+{
+    uint8_t data[FAKE_CLOUD_MAX_SESSION_LEN];
+    size_t len;
+    bool finished;
+};
+
+/* Uploads received by the fake cloud, in order */
+extern struct fake_cloud_session fake_cloud_sessions[FAKE_CLOUD_MAX_SESSIONS];
+
+/* Passed to the spool in place of a connected client */
+extern struct golioth_client *const fake_cloud_client;
+
+/* Whether the uplink module sees the client as connected, false after a reset */
+extern bool fake_cloud_connected;
+
+void fake_cloud_reset(void);
+
+/* Fails all following blocks with the given status, until the next reset */
+void fake_cloud_fail(enum golioth_status status, uint8_t code_class, uint8_t code_detail);
+size_t fake_cloud_finished(void);
+
+/* Waits for the given number of uploads to finish, and for the spool to
+   store their completion */
+bool fake_cloud_wait(size_t sessions);
@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2025 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/ztest.h>
+
+#include "cloud.h"
+#include "spool.h"
+
+#define BLOCK_SIZE CONFIG_GOLIOTH_BLOCKWISE_UPLOAD_MAX_BLOCK_SIZE
+#define SESSION_LEN (2 * BLOCK_SIZE + 100)
+
+static uint8_t payload[SESSION_LEN];
+
+static void fill_payload(uint8_t seed)
+{
+    for (size_t i = 0; i < sizeof(payload); i++)
+    {
+        payload[i] = seed + i * 7;
+    }
+}
+
+/* Writes a session in blocks, the way the uplink module does */
+static void write_session(uint32_t session, size_t len, bool complete)
+{
+    size_t offset = 0;
+
+    while (offset < len)
+    {
+        size_t chunk = MIN(len - offset, BLOCK_SIZE);
+        bool is_last = complete && offset + chunk == len;
+
+        zassert_ok(spool_session_write(session, &payload[offset], chunk, offset == 0, is_last));
+        offset += chunk;
+    }
+}
+
+static void assert_delivered(size_t idx, size_t len)
+{
+    zassert_true(fake_cloud_sessions[idx].finished);
+    zassert_equal(fake_cloud_sessions[idx].len, len);
+    zassert_mem_equal(fake_cloud_sessions[idx].data, payload, len);
+}
+
+ZTEST(spool, test_write_drain)
+{
+    fill_payload(1);
+
+    uint32_t session = spool_session_open();
+    write_session(session, SESSION_LEN, true);
+
+    spool_drain(fake_cloud_client);
+
+    zassert_true(fake_cloud_wait(1));
+    assert_delivered(0, SESSION_LEN);
+
+    /* Delivered sessions are not delivered again */
+    spool_drain(fake_cloud_client);
+
+    zassert_true(fake_cloud_wait(1));
+    zassert_equal(fake_cloud_finished(), 1);
+}
+
+ZTEST(spool, test_abort)
+{
+    fill_payload(2);
+
+    uint32_t aborted = spool_session_open();
+    write_session(aborted, BLOCK_SIZE, false);
+    spool_session_abort(aborted);
+
+    uint32_t session = spool_session_open();
+    write_session(session, SESSION_LEN, true);
+
+    spool_drain(fake_cloud_client);
+
+    zassert_true(fake_cloud_wait(1));
+    zassert_equal(fake_cloud_finished(), 1);
+    assert_delivered(0, SESSION_LEN);
+}
+
+ZTEST(spool, test_reboot_drops_incomplete)
+{
+    fill_payload(3);
+
+    /* Cut short by a reboot */
+    uint32_t incomplete = spool_session_open();
+    write_session(incomplete, BLOCK_SIZE, false);
+
+    zassert_ok(spool_init());
+
+    uint32_t session = spool_session_open();
+    zassert_true(session > incomplete);
+    write_session(session, SESSION_LEN, true);
+
+    spool_drain(fake_cloud_client);
+
+    zassert_true(fake_cloud_wait(1));
+    zassert_equal(fake_cloud_finished(), 1);
+    assert_delivered(0, SESSION_LEN);
+
+    /* The dropped session stays dropped after the next reboot */
+    zassert_ok(spool_init());
+
+    spool_drain(fake_cloud_client);
+
+    zassert_true(fake_cloud_wait(1));
+    zassert_equal(fake_cloud_finished(), 1);
+}
+
+ZTEST(spool, test_completed_before_reboot)
+{
+    fill_payload(4);
+
+    uint32_t session = spool_session_open();
+    write_session(session, SESSION_LEN, true);
+
+    zassert_ok(spool_init());
+
+    spool_drain(fake_cloud_client);
+
+    zassert_true(fake_cloud_wait(1));
+    assert_delivered(0, SESSION_LEN);
+}
+
+ZTEST(spool, test_rejected_session_dropped)
+{
+    fill_payload(5);
+
+    uint32_t rejected = spool_session_open();
+    write_session(rejected, SESSION_LEN, true);
+
+    fake_cloud_fail(GOLIOTH_ERR_COAP_RESPONSE, 4, 3);
+
+    spool_drain(fake_cloud_client);
+
+    zassert_true(fake_cloud_wait(1));
+
+    /* The rejected session doesn't hold up the one behind it */
+    fake_cloud_reset();
+
+    uint32_t session = spool_session_open();
+    write_session(session, SESSION_LEN, true);
+
+    spool_drain(fake_cloud_client);
+
+    zassert_true(fake_cloud_wait(1));
+    zassert_equal(fake_cloud_finished(), 1);
+    assert_delivered(0, SESSION_LEN);
+}
+
+ZTEST(spool, test_failing_session_dropped)
+{
+    fill_payload(6);
+
+    uint32_t failing = spool_session_open();
+    write_session(failing, SESSION_LEN, true);
+
+    fake_cloud_fail(GOLIOTH_ERR_TIMEOUT, 0, 0);
+
+    /* Each drain makes one attempt */
+    for (int i = 0; i < CONFIG_POUCH_GATEWAY_SPOOL_MAX_ATTEMPTS; i++)
+    {
+        spool_drain(fake_cloud_client);
+
+        zassert_true(fake_cloud_wait(i + 1), "Attempt %d not made", i);
+    }
+
+    fake_cloud_reset();
+
+    spool_drain(fake_cloud_client);
+
+    zassert_true(fake_cloud_wait(0));
+    zassert_equal(fake_cloud_finished(), 0, "Session not dropped");
+}
+
+ZTEST(spool, test_reclaim)
+{
+    const struct flash_area *fap;
+
+    zassert_ok(flash_area_open(FIXED_PARTITION_ID(pouch_spool_partition), &fap));
+    size_t partition_size = fap->fa_size;
+    flash_area_close(fap);
+
+    /* Without erasing the sectors of delivered sessions, the spool runs out
+       of space long before this */
+    size_t cycles = 4 * partition_size / SESSION_LEN;
+
+    for (size_t i = 0; i < cycles; i++)
+    {
+        fill_payload(i);
+
+        uint32_t session = spool_session_open();
+        write_session(session, SESSION_LEN, true);
+
+        spool_drain(fake_cloud_client);
+
+        zassert_true(fake_cloud_wait(i + 1), "Session %zu not delivered", i);
+        assert_delivered(i % FAKE_CLOUD_MAX_SESSIONS, SESSION_LEN);
+    }
+}
+
+static void spool_before(void *fixture)
+{
+    const struct flash_area *fap;
+
+    zassert_ok(flash_area_open(FIXED_PARTITION_ID(pouch_spool_partition), &fap));
+    zassert_ok(flash_area_erase(fap, 0, fap->fa_size));
+    flash_area_close(fap);
+
+    zassert_ok(spool_init());
+
+    fake_cloud_reset();
+}
+
+ZTEST_SUITE(spool, NULL, NULL, spool_before, NULL, NULL);
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2025 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/ztest.h>
+
+#include <pouch_gateway/uplink.h>
+
+#include "block.h"
+#include "cloud.h"
+#include "spool.h"
+
+static uint8_t payload[3 * CONFIG_GOLIOTH_BLOCKWISE_UPLOAD_MAX_BLOCK_SIZE + 10];
+
+static atomic_t ended;
+static enum pouch_gateway_uplink_result result;
+
+static void end_cb(void *arg, enum pouch_gateway_uplink_result res)
+{
+    result = res;
+    atomic_inc(&ended);
+}
+
+static void resume_cb(void *arg) {}
+
+static bool wait_ended(void)
+{
+    for (int i = 0; i < 1000 && !atomic_get(&ended); i++)
+    {
+        k_sleep(K_MSEC(10));
+    }
+
+    return atomic_get(&ended);
+}
+
+ZTEST(uplink_spool, test_spooled_uplink)
+{
+    zassert_true(pouch_gateway_uplink_can_spool());
+
+    struct pouch_gateway_uplink *uplink = pouch_gateway_uplink_open(NULL, end_cb, resume_cb, NULL);
+    zassert_not_null(uplink);
+
+    size_t half = sizeof(payload) / 2;
+
+    zassert_ok(pouch_gateway_uplink_write(uplink, payload, half, false));
+    zassert_ok(pouch_gateway_uplink_write(uplink, &payload[half], sizeof(payload) - half, true));
+
+    /* Blocks are written to flash by the spool work queue */
+    zassert_true(wait_ended());
+    zassert_equal(result, POUCH_GATEWAY_UPLINK_SUCCESS);
+    zassert_equal(block_pool_used(), 0);
+
+    spool_drain(fake_cloud_client);
+
+    zassert_true(fake_cloud_wait(1));
+    zassert_equal(fake_cloud_sessions[0].len, sizeof(payload));
+    zassert_mem_equal(fake_cloud_sessions[0].data, payload, sizeof(payload));
+}
+
+ZTEST(uplink_spool, test_aborted_uplink)
+{
+    struct pouch_gateway_uplink *uplink = pouch_gateway_uplink_open(NULL, end_cb, resume_cb, NULL);
+    zassert_not_null(uplink);
+
+    zassert_ok(pouch_gateway_uplink_write(uplink, payload, sizeof(payload), false));
+
+    pouch_gateway_uplink_abort(uplink);
+
+    zassert_true(wait_ended());
+    zassert_equal(result, POUCH_GATEWAY_UPLINK_ERROR_LOCAL);
+
+    spool_drain(fake_cloud_client);
+
+    zassert_true(fake_cloud_wait(0));
+    zassert_equal(fake_cloud_finished(), 0);
+}
+
+ZTEST(uplink_spool, test_aggregated_uplink_not_spooled)
+{
+    Z_TEST_SKIP_IFNDEF(CONFIG_POUCH_GATEWAY_UPLINK_AGGREGATE);
+
+    const size_t len = 16;
+
+    fake_cloud_connected = true;
+    pouch_gateway_uplink_module_on_connected(fake_cloud_client);
+
+    struct pouch_gateway_uplink *uplink = pouch_gateway_uplink_open(NULL, end_cb, resume_cb, NULL);
+    zassert_not_null(uplink);
+
+    zassert_ok(pouch_gateway_uplink_write(uplink, payload, len, true));
+
+    zassert_true(wait_ended());
+    zassert_equal(result, POUCH_GATEWAY_UPLINK_SUCCESS);
+    zassert_equal(block_pool_used(), 0);
+
+    /* Uploaded in a batch, with its length in front */
+    zassert_true(fake_cloud_wait(2));
+    zassert_equal(fake_cloud_sessions[0].len, sizeof(uint16_t) + len);
+    zassert_equal(sys_get_le16(fake_cloud_sessions[0].data), len);
+    zassert_mem_equal(&fake_cloud_sessions[0].data[sizeof(uint16_t)], payload, len);
+
+    /* The cloud didn't acknowledge the batch, so the pouch went out on its own */
+    zassert_equal(fake_cloud_sessions[1].len, len);
+    zassert_mem_equal(fake_cloud_sessions[1].data, payload, len);
+
+    /* Nothing was spooled along the way */
+    fake_cloud_reset();
+    spool_drain(fake_cloud_client);
+
+    zassert_true(fake_cloud_wait(0));
+    zassert_equal(fake_cloud_finished(), 0);
+}
+
+static void *uplink_spool_setup(void)
+{
+    const struct flash_area *fap;
+
+    for (size_t i = 0; i < sizeof(payload); i++)
+    {
+        payload[i] = i;
+    }
+
+    zassert_ok(flash_area_open(FIXED_PARTITION_ID(pouch_spool_partition), &fap));
+    zassert_ok(flash_area_erase(fap, 0, fap->fa_size));
+    flash_area_close(fap);
+
+    /* Without a client, uplinks are spooled */
+    pouch_gateway_uplink_module_init(NULL);
+
+    return NULL;
+}
+
+static void uplink_spool_before(void *fixture)
+{
+    atomic_clear(&ended);
+    fake_cloud_reset();
+}
+
+ZTEST_SUITE(uplink_spool, NULL, uplink_spool_setup, uplink_spool_before, NULL, NULL);
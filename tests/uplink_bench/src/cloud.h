@@ -0,0 +1,19 @@
+/*
+ * Copyright (c) 2025 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#include <golioth/client.h>
+
+/* Passed to the uplink module in place of a connected client */
+extern struct golioth_client *const fake_cloud_client;
+
+void fake_cloud_reset(void);
+
+/* Payload bytes acknowledged since the last reset */
+size_t fake_cloud_bytes(void);
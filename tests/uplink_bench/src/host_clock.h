@@ -0,0 +1,12 @@
+/*
+ * Copyright (c) 2025 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* Monotonic host time in nanoseconds */
+uint64_t host_clock_ns(void);
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2025 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/sys/atomic.h>
+#include <zephyr/ztest.h>
+
+#include <pouch_gateway/uplink.h>
+
+#include "block.h"
+#include "cloud.h"
+#include "host_clock.h"
+
+#define BENCH_POUCHES 1000
+
+/* ATT payload of a write with the largest MTU nodes negotiate */
+#define BENCH_PACKET_LEN 244
+
+static uint8_t payload[4 * CONFIG_GOLIOTH_BLOCKWISE_UPLOAD_MAX_BLOCK_SIZE];
+
+static K_SEM_DEFINE(ended, 0, 1);
+static atomic_t failed;
+
+static void end_cb(void *arg, enum pouch_gateway_uplink_result res)
+{
+    if (res != POUCH_GATEWAY_UPLINK_SUCCESS)
+    {
+        atomic_inc(&failed);
+    }
+
+    k_sem_give(&ended);
+}
+
+static void resume_cb(void *arg) {}
+
+/* Writes each pouch in packets as the GATT transport does, one node at a
+   time, and reports the host time spent per packet and per pouch */
+static void bench_pouches(size_t len)
+{
+    size_t packets = 0;
+    uint64_t write_ns = 0;
+
+    fake_cloud_reset();
+    atomic_clear(&failed);
+
+    uint64_t start = host_clock_ns();
+
+    for (int i = 0; i < BENCH_POUCHES; i++)
+    {
+        struct pouch_gateway_uplink *uplink =
+            pouch_gateway_uplink_open(NULL, end_cb, resume_cb, NULL);
+        zassert_not_null(uplink);
+
+        for (size_t offset = 0; offset < len; offset += BENCH_PACKET_LEN)
+        {
+            size_t packet_len = MIN(BENCH_PACKET_LEN, len - offset);
+            bool is_last = offset + packet_len == len;
+
+            uint64_t write_start = host_clock_ns();
+
+            zassert_ok(pouch_gateway_uplink_write(uplink, &payload[offset], packet_len, is_last));
+
+            write_ns += host_clock_ns() - write_start;
+            packets++;
+        }
+
+        zassert_ok(k_sem_take(&ended, K_SECONDS(10)));
+    }
+
+    uint64_t total_ns = host_clock_ns() - start;
+
+    zassert_equal(atomic_get(&failed), 0);
+    zassert_equal(fake_cloud_bytes(), BENCH_POUCHES * len);
+    zassert_equal(block_pool_used(), 0);
+
+    TC_PRINT("%zu byte pouches: %llu ns per packet written, %llu ns per pouch delivered\n",
+             len,
+             (unsigned long long) (write_ns / packets),
+             (unsigned long long) (total_ns / BENCH_POUCHES));
+}
+
+/* Fits a single block fragment, delivered without assembling the block */
+ZTEST(uplink_bench, test_small_pouch)
+{
+    bench_pouches(CONFIG_POUCH_GATEWAY_BLOCK_FRAGMENT_SIZE / 2);
+}
+
+ZTEST(uplink_bench, test_single_packet_pouch)
+{
+    bench_pouches(BENCH_PACKET_LEN);
+}
+
+ZTEST(uplink_bench, test_multi_block_pouch)
+{
+    bench_pouches(sizeof(payload));
+}
+
+static void *uplink_bench_setup(void)
+{
+    for (size_t i = 0; i < sizeof(payload); i++)
+    {
+        payload[i] = i;
+    }
+
+    pouch_gateway_uplink_module_init(fake_cloud_client);
+
+    return NULL;
+}
+
+ZTEST_SUITE(uplink_bench, NULL, uplink_bench_setup, NULL, NULL, NULL);
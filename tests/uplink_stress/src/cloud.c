@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2025 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+
+#include <golioth/gateway.h>
+
+#include "cloud.h"
+
+#define FAKE_CLOUD_MAX_SESSIONS 8
+#define FAKE_CLOUD_MAX_PENDING 32
+
+typedef enum golioth_status (*fake_cloud_block_cb)(const uint8_t *data,
+                                                   size_t len,
+                                                   bool is_last,
+                                                   void *arg);
+typedef void (*fake_cloud_end_cb)(enum golioth_status status,
+                                  const struct golioth_coap_rsp_code *coap_rsp_code,
+                                  void *arg);
+typedef void (*fake_cloud_set_cb)(struct golioth_client *client,
+                                  enum golioth_status status,
+                                  const struct golioth_coap_rsp_code *coap_rsp_code,
+                                  const char *path,
+                                  size_t block_size,
+                                  void *arg);
+
+struct fake_cloud_session
+{
+    fake_cloud_block_cb block_cb;
+    fake_cloud_end_cb end_cb;
+    void *arg;
+    size_t downlink_len;
+};
+
+struct fake_cloud_ack
+{
+    struct fake_cloud_session *session;
+    fake_cloud_set_cb set_cb;
+    void *arg;
+    size_t len;
+    bool is_last;
+};
+
+static char client_placeholder;
+struct golioth_client *const fake_cloud_client = (struct golioth_client *) &client_placeholder;
+
+const uint8_t fake_cloud_downlink[FAKE_CLOUD_MAX_DOWNLINK_LEN] = {
+    [0 ... FAKE_CLOUD_MAX_DOWNLINK_LEN - 1] = 0xa5,
+};
+
+static struct fake_cloud_session sessions[FAKE_CLOUD_MAX_SESSIONS];
+static ATOMIC_DEFINE(sessions_used, FAKE_CLOUD_MAX_SESSIONS);
+static atomic_t next_downlink_len;
+static atomic_t bytes;
+
+K_MSGQ_DEFINE(ack_msgq, sizeof(struct fake_cloud_ack), FAKE_CLOUD_MAX_PENDING, 4);
+
+/* The downlink is the response to the last block, so it is delivered before
+   that block is acknowledged */
+static void send_downlink(struct fake_cloud_session *session)
+{
+    size_t offset = 0;
+
+    while (offset < session->downlink_len)
+    {
+        size_t len =
+            MIN(CONFIG_GOLIOTH_BLOCKWISE_UPLOAD_MAX_BLOCK_SIZE, session->downlink_len - offset);
+        bool is_last = offset + len == session->downlink_len;
+
+        if (GOLIOTH_OK != session->block_cb(&fake_cloud_downlink[offset], len, is_last, session->arg))
+        {
+            session->end_cb(GOLIOTH_ERR_FAIL, NULL, session->arg);
+            return;
+        }
+
+        offset += len;
+    }
+
+    session->end_cb(GOLIOTH_OK, NULL, session->arg);
+}
+
+/* Blocks are acknowledged from a work item, like the Golioth client does
+   from its own thread, never from within golioth_gateway_uplink_block() */
+static void ack_work_handler(struct k_work *work)
+{
+    struct fake_cloud_ack ack;
+
+    while (0 == k_msgq_get(&ack_msgq, &ack, K_NO_WAIT))
+    {
+        if (ack.is_last)
+        {
+            send_downlink(ack.session);
+        }
+
+        atomic_add(&bytes, ack.len);
+        ack.set_cb(fake_cloud_client, GOLIOTH_OK, NULL, NULL, ack.len, ack.arg);
+    }
+}
+
+static K_WORK_DEFINE(ack_work, ack_work_handler);
+
+void fake_cloud_reset(void)
+{
+    atomic_clear(&bytes);
+}
+
+void fake_cloud_next_downlink(size_t len)
+{
+    atomic_set(&next_downlink_len, MIN(len, FAKE_CLOUD_MAX_DOWNLINK_LEN));
+}
+
+size_t fake_cloud_bytes(void)
+{
+    return atomic_get(&bytes);
+}
+
+bool __wrap_golioth_client_is_connected(struct golioth_client *client)
+{
+    return client == fake_cloud_client;
+}
+
+struct gateway_uplink *__wrap_golioth_gateway_uplink_start(struct golioth_client *client,
+                                                           fake_cloud_block_cb block_cb,
+                                                           fake_cloud_end_cb end_cb,
+                                                           void *arg)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(sessions); i++)
+    {
+        if (!atomic_test_and_set_bit(sessions_used, i))
+        {
+            sessions[i].block_cb = block_cb;
+            sessions[i].end_cb = end_cb;
+            sessions[i].arg = arg;
+            sessions[i].downlink_len = atomic_get(&next_downlink_len);
+
+            return (struct gateway_uplink *) &sessions[i];
+        }
+    }
+
+    return NULL;
+}
+
+enum golioth_status __wrap_golioth_gateway_uplink_block(struct gateway_uplink *uplink,
+                                                        uint32_t block_idx,
+                                                        const uint8_t *buf,
+                                                        size_t buf_len,
+                                                        bool is_last,
+                                                        fake_cloud_set_cb set_cb,
+                                                        void *arg)
+{
+    struct fake_cloud_ack ack = {
+        .session = (struct fake_cloud_session *) uplink,
+        .set_cb = set_cb,
+        .arg = arg,
+        .len = buf_len,
+        .is_last = is_last,
+    };
+
+    if (0 != k_msgq_put(&ack_msgq, &ack, K_NO_WAIT))
+    {
+        return GOLIOTH_ERR_MEM_ALLOC;
+    }
+
+    k_work_submit(&ack_work);
+
+    return GOLIOTH_OK;
+}
+
+void __wrap_golioth_gateway_uplink_finish(struct gateway_uplink *uplink)
+{
+    struct fake_cloud_session *session = (struct fake_cloud_session *) uplink;
+
+    atomic_clear_bit(sessions_used, session - sessions);
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright (c) 2025 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <golioth/client.h>
+
+#define FAKE_CLOUD_MAX_DOWNLINK_LEN 2048
+
+/* Passed to the uplink module in place of a connected client */
+extern struct golioth_client *const fake_cloud_client;
+
+/* Downlink data sent in response to uplinks, its offset is its value */
+extern const uint8_t fake_cloud_downlink[FAKE_CLOUD_MAX_DOWNLINK_LEN];
+
+void fake_cloud_reset(void);
+
+/* The session started by the next uplink is answered with this many bytes
+   of downlink data, once its last block is acknowledged */
+void fake_cloud_next_downlink(size_t len);
+
+/* Payload bytes acknowledged since the last reset */
+size_t fake_cloud_bytes(void);
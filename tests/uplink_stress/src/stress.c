@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2025 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdlib.h>
+
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/mem_stats.h>
+#include <zephyr/ztest.h>
+
+#include <pouch_gateway/downlink.h>
+#include <pouch_gateway/uplink.h>
+
+#include "block.h"
+#include "cloud.h"
+
+#define STRESS_SESSIONS 4000
+#define STRESS_WARMUP_SESSIONS 100
+#define STRESS_CONCURRENT CONFIG_POUCH_GATEWAY_UPLINK_MAX_SESSIONS
+#define STRESS_MAX_POUCH 2048
+
+/* ATT payload of a write with the largest MTU nodes negotiate */
+#define STRESS_PACKET_LEN 244
+
+/* Provided by the common libc malloc with CONFIG_SYS_HEAP_RUNTIME_STATS */
+int malloc_runtime_stats_get(struct sys_memory_stats *stats);
+
+struct stress_node
+{
+    struct pouch_gateway_downlink_context *downlink;
+    size_t downlink_len;
+};
+
+static struct stress_node nodes[STRESS_CONCURRENT];
+static uint8_t payload[STRESS_MAX_POUCH];
+static uint32_t rand_state;
+static size_t uplink_bytes;
+
+static K_SEM_DEFINE(ended, 0, STRESS_CONCURRENT);
+static atomic_t failed;
+
+static void end_cb(void *arg, enum pouch_gateway_uplink_result res)
+{
+    if (res != POUCH_GATEWAY_UPLINK_SUCCESS)
+    {
+        atomic_inc(&failed);
+    }
+
+    k_sem_give(&ended);
+}
+
+static void resume_cb(void *arg) {}
+
+static void data_available_cb(void *arg) {}
+
+/* Deterministic, so a failing run can be reproduced */
+static size_t next_len(void)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+
+    return 1 + (rand_state >> 16) % STRESS_MAX_POUCH;
+}
+
+static void start_session(struct stress_node *node)
+{
+    node->downlink_len = next_len();
+    node->downlink = pouch_gateway_downlink_open(data_available_cb, node);
+    zassert_not_null(node->downlink);
+
+    fake_cloud_next_downlink(node->downlink_len);
+
+    struct pouch_gateway_uplink *uplink =
+        pouch_gateway_uplink_open(node->downlink, end_cb, resume_cb, node);
+    zassert_not_null(uplink);
+
+    size_t len = next_len();
+    uplink_bytes += len;
+
+    for (size_t offset = 0; offset < len; offset += STRESS_PACKET_LEN)
+    {
+        size_t packet_len = MIN(STRESS_PACKET_LEN, len - offset);
+        bool is_last = offset + packet_len == len;
+
+        zassert_ok(pouch_gateway_uplink_write(uplink, &payload[offset], packet_len, is_last));
+    }
+}
+
+static void finish_session(struct stress_node *node)
+{
+    uint8_t buf[STRESS_PACKET_LEN];
+    size_t total = 0;
+    bool is_last = false;
+
+    while (!is_last)
+    {
+        size_t len = sizeof(buf);
+
+        zassert_ok(pouch_gateway_downlink_get_data(node->downlink, buf, &len, &is_last));
+        zassert_mem_equal(buf, &fake_cloud_downlink[total], len);
+
+        total += len;
+    }
+
+    zassert_equal(total, node->downlink_len);
+    zassert_true(pouch_gateway_downlink_is_complete(node->downlink));
+
+    pouch_gateway_downlink_close(node->downlink);
+    node->downlink = NULL;
+}
+
+/* Runs sessions on all nodes at once, so their blocks and heap allocations
+   interleave, and sizes vary so they are freed in different orders */
+static void run_sessions(size_t count)
+{
+    for (size_t done = 0; done < count; done += STRESS_CONCURRENT)
+    {
+        for (size_t i = 0; i < STRESS_CONCURRENT; i++)
+        {
+            start_session(&nodes[i]);
+        }
+
+        for (size_t i = 0; i < STRESS_CONCURRENT; i++)
+        {
+            zassert_ok(k_sem_take(&ended, K_SECONDS(10)));
+        }
+
+        zassert_equal(atomic_get(&failed), 0);
+
+        for (size_t i = 0; i < STRESS_CONCURRENT; i++)
+        {
+            finish_session(&nodes[STRESS_CONCURRENT - 1 - i]);
+        }
+    }
+}
+
+/* Largest single allocation the heap can serve */
+static size_t largest_free_chunk(size_t free_bytes)
+{
+    size_t lo = 0;
+    size_t hi = free_bytes;
+
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo + 1) / 2;
+        void *p = malloc(mid);
+
+        if (p)
+        {
+            free(p);
+            lo = mid;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+
+    return lo;
+}
+
+ZTEST(uplink_stress, test_sessions)
+{
+    struct sys_memory_stats before;
+    struct sys_memory_stats warm;
+    struct sys_memory_stats after;
+
+    zassert_ok(malloc_runtime_stats_get(&before));
+    size_t largest_before = largest_free_chunk(before.free_bytes);
+
+    run_sessions(STRESS_WARMUP_SESSIONS);
+    zassert_ok(malloc_runtime_stats_get(&warm));
+
+    run_sessions(STRESS_SESSIONS - STRESS_WARMUP_SESSIONS);
+    zassert_ok(malloc_runtime_stats_get(&after));
+    size_t largest_after = largest_free_chunk(after.free_bytes);
+
+    zassert_equal(fake_cloud_bytes(), uplink_bytes);
+    zassert_equal(block_pool_used(), 0);
+
+    /* Everything is returned, and the peak doesn't grow with the number of
+       sessions. Only the overflow queues, which are bounded per downlink,
+       may take it past what the warmup reached. */
+    size_t overflow_max = STRESS_CONCURRENT * CONFIG_POUCH_GATEWAY_DOWNLINK_OVERFLOW_BLOCKS
+        * (CONFIG_GOLIOTH_BLOCKWISE_UPLOAD_MAX_BLOCK_SIZE + 64);
+
+    zassert_equal(after.allocated_bytes, before.allocated_bytes);
+    zassert_true(after.max_allocated_bytes <= warm.max_allocated_bytes + overflow_max);
+
+    /* Freed allocations coalesce again */
+    zassert_equal(largest_after, largest_before);
+
+    TC_PRINT("%d sessions, %d at a time: heap peak %zu bytes, block fragments peak %zu of %d\n",
+             STRESS_SESSIONS,
+             STRESS_CONCURRENT,
+             after.max_allocated_bytes - before.allocated_bytes,
+             block_pool_max_used(),
+             CONFIG_POUCH_GATEWAY_NUM_BLOCK_FRAGMENTS);
+    TC_PRINT("Largest free heap chunk: %zu of %zu free bytes\n", largest_after, after.free_bytes);
+}
+
+static void *uplink_stress_setup(void)
+{
+    fake_cloud_reset();
+
+    for (size_t i = 0; i < sizeof(payload); i++)
+    {
+        payload[i] = i;
+    }
+
+    pouch_gateway_uplink_module_init(fake_cloud_client);
+    pouch_gateway_downlink_module_init(fake_cloud_client);
+
+    return NULL;
+}
+
+ZTEST_SUITE(uplink_stress, NULL, uplink_stress_setup, NULL, NULL, NULL);
@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2025 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+
+#include <golioth/gateway.h>
+
+#include "cloud.h"
+
+#define FAKE_CLOUD_MAX_PENDING 32
+
+typedef void (*fake_cloud_set_cb)(struct golioth_client *client,
+                                  enum golioth_status status,
+                                  const struct golioth_coap_rsp_code *coap_rsp_code,
+                                  const char *path,
+                                  size_t block_size,
+                                  void *arg);
+
+struct fake_cloud_ack
+{
+    struct k_work_delayable work;
+    fake_cloud_set_cb set_cb;
+    void *arg;
+    size_t len;
+    enum golioth_status status;
+};
+
+static char client_placeholder;
+struct golioth_client *const fake_cloud_client = (struct golioth_client *) &client_placeholder;
+
+static char session_placeholder;
+static atomic_t bytes;
+static atomic_t rtt;
+
+static struct fake_cloud_ack acks[FAKE_CLOUD_MAX_PENDING];
+static ATOMIC_DEFINE(acks_used, FAKE_CLOUD_MAX_PENDING);
+
+static struct k_spinlock lock;
+static uint32_t sent[FAKE_CLOUD_MAX_SENT];
+static size_t sent_count;
+static size_t failed_at;
+static uint32_t fail_idx;
+static bool fail_pending;
+
+/* Acknowledged from the system work queue, like the Golioth client does
+   from its own thread, never from within golioth_gateway_uplink_block() */
+static void ack_work_handler(struct k_work *work)
+{
+    struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+    struct fake_cloud_ack *ack = CONTAINER_OF(dwork, struct fake_cloud_ack, work);
+    fake_cloud_set_cb set_cb = ack->set_cb;
+    void *arg = ack->arg;
+    size_t len = ack->len;
+    enum golioth_status status = ack->status;
+
+    if (status == GOLIOTH_OK)
+    {
+        atomic_add(&bytes, len);
+    }
+    else
+    {
+        K_SPINLOCK(&lock)
+        {
+            failed_at = sent_count;
+        }
+    }
+
+    atomic_clear_bit(acks_used, ack - acks);
+
+    set_cb(fake_cloud_client, status, NULL, NULL, len, arg);
+}
+
+void fake_cloud_reset(void)
+{
+    atomic_clear(&bytes);
+
+    K_SPINLOCK(&lock)
+    {
+        sent_count = 0;
+        failed_at = 0;
+        fail_pending = false;
+    }
+}
+
+void fake_cloud_set_rtt(uint32_t rtt_ms)
+{
+    atomic_set(&rtt, rtt_ms);
+}
+
+void fake_cloud_fail_once(uint32_t block_idx)
+{
+    K_SPINLOCK(&lock)
+    {
+        fail_idx = block_idx;
+        fail_pending = true;
+    }
+}
+
+size_t fake_cloud_bytes(void)
+{
+    return atomic_get(&bytes);
+}
+
+size_t fake_cloud_sent(const uint32_t **log)
+{
+    *log = sent;
+
+    return MIN(sent_count, ARRAY_SIZE(sent));
+}
+
+size_t fake_cloud_failed_at(void)
+{
+    return failed_at;
+}
+
+bool __wrap_golioth_client_is_connected(struct golioth_client *client)
+{
+    return client == fake_cloud_client;
+}
+
+struct gateway_uplink *__wrap_golioth_gateway_uplink_start(
+    struct golioth_client *client,
+    enum golioth_status (*block_cb)(const uint8_t *data, size_t len, bool is_last, void *arg),
+    void (*end_cb)(enum golioth_status status,
+                   const struct golioth_coap_rsp_code *coap_rsp_code,
+                   void *arg),
+    void *arg)
+{
+    return (struct gateway_uplink *) &session_placeholder;
+}
+
+enum golioth_status __wrap_golioth_gateway_uplink_block(struct gateway_uplink *uplink,
+                                                        uint32_t block_idx,
+                                                        const uint8_t *buf,
+                                                        size_t buf_len,
+                                                        bool is_last,
+                                                        fake_cloud_set_cb set_cb,
+                                                        void *arg)
+{
+    struct fake_cloud_ack *ack = NULL;
+
+    for (size_t i = 0; i < ARRAY_SIZE(acks); i++)
+    {
+        if (!atomic_test_and_set_bit(acks_used, i))
+        {
+            ack = &acks[i];
+            break;
+        }
+    }
+
+    if (ack == NULL)
+    {
+        return GOLIOTH_ERR_MEM_ALLOC;
+    }
+
+    ack->set_cb = set_cb;
+    ack->arg = arg;
+    ack->len = buf_len;
+    ack->status = GOLIOTH_OK;
+
+    K_SPINLOCK(&lock)
+    {
+        if (sent_count < ARRAY_SIZE(sent))
+        {
+            sent[sent_count] = block_idx;
+        }
+        sent_count++;
+
+        if (fail_pending && block_idx == fail_idx)
+        {
+            ack->status = GOLIOTH_ERR_FAIL;
+            fail_pending = false;
+        }
+    }
+
+    k_work_init_delayable(&ack->work, ack_work_handler);
+    k_work_schedule(&ack->work, K_MSEC(atomic_get(&rtt)));
+
+    return GOLIOTH_OK;
+}
+
+void __wrap_golioth_gateway_uplink_finish(struct gateway_uplink *uplink) {}
@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) 2025 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <golioth/client.h>
+
+#define FAKE_CLOUD_MAX_SENT 64
+
+/* Passed to the uplink module in place of a connected client */
+extern struct golioth_client *const fake_cloud_client;
+
+void fake_cloud_reset(void);
+
+/* Each block is acknowledged this long after it was sent */
+void fake_cloud_set_rtt(uint32_t rtt_ms);
+
+/* Fails the first delivery of the given block index, until the next reset */
+void fake_cloud_fail_once(uint32_t block_idx);
+
+/* Payload bytes acknowledged since the last reset */
+size_t fake_cloud_bytes(void);
+
+/* Indices of the blocks sent since the last reset, in order, including resent
+   blocks. Returns the number of entries. */
+size_t fake_cloud_sent(const uint32_t **sent);
+
+/* Number of blocks that had been sent when the failure was reported */
+size_t fake_cloud_failed_at(void);
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2025 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/sys/atomic.h>
+#include <zephyr/ztest.h>
+
+#include <pouch_gateway/uplink.h>
+
+#include "block.h"
+#include "cloud.h"
+
+#define BENCH_POUCHES 20
+#define BENCH_BLOCKS 8
+
+/* ATT payload of a write with the largest MTU nodes negotiate */
+#define BENCH_PACKET_LEN 244
+
+static uint8_t payload[BENCH_BLOCKS * CONFIG_GOLIOTH_BLOCKWISE_UPLOAD_MAX_BLOCK_SIZE];
+
+static K_SEM_DEFINE(ended, 0, 1);
+static atomic_t failed;
+
+static void end_cb(void *arg, enum pouch_gateway_uplink_result res)
+{
+    if (res != POUCH_GATEWAY_UPLINK_SUCCESS)
+    {
+        atomic_inc(&failed);
+    }
+
+    k_sem_give(&ended);
+}
+
+static void resume_cb(void *arg) {}
+
+static void send_pouch(void)
+{
+    struct pouch_gateway_uplink *uplink = pouch_gateway_uplink_open(NULL, end_cb, resume_cb, NULL);
+    zassert_not_null(uplink);
+
+    for (size_t offset = 0; offset < sizeof(payload); offset += BENCH_PACKET_LEN)
+    {
+        size_t packet_len = MIN(BENCH_PACKET_LEN, sizeof(payload) - offset);
+        bool is_last = offset + packet_len == sizeof(payload);
+
+        zassert_ok(pouch_gateway_uplink_write(uplink, &payload[offset], packet_len, is_last));
+    }
+
+    zassert_ok(k_sem_take(&ended, K_SECONDS(60)));
+}
+
+/* Delivers pouches over a link with the given round trip time and reports
+   the throughput. Acknowledgements are delayed in simulated time, so the
+   result only depends on the window and the round trip time. */
+static void bench_rtt(uint32_t rtt_ms)
+{
+    fake_cloud_reset();
+    fake_cloud_set_rtt(rtt_ms);
+    atomic_clear(&failed);
+
+    int64_t start = k_uptime_get();
+
+    for (int i = 0; i < BENCH_POUCHES; i++)
+    {
+        send_pouch();
+    }
+
+    int64_t elapsed = k_uptime_get() - start;
+
+    zassert_equal(atomic_get(&failed), 0);
+    zassert_equal(fake_cloud_bytes(), BENCH_POUCHES * sizeof(payload));
+    zassert_equal(block_pool_used(), 0);
+
+    /* The last block is only sent once all others are acknowledged */
+    int64_t round_trips =
+        DIV_ROUND_UP(BENCH_BLOCKS - 1, CONFIG_POUCH_GATEWAY_UPLINK_WINDOW) + 1;
+
+    zassert_true(elapsed >= BENCH_POUCHES * round_trips * rtt_ms);
+    zassert_true(elapsed <= BENCH_POUCHES * (round_trips + 1) * rtt_ms,
+                 "%lld ms for %lld round trips of %u ms",
+                 elapsed / BENCH_POUCHES,
+                 round_trips,
+                 rtt_ms);
+
+    TC_PRINT("Window %d, RTT %u ms: %lld ms per pouch, %lld bytes/s\n",
+             CONFIG_POUCH_GATEWAY_UPLINK_WINDOW,
+             rtt_ms,
+             elapsed / BENCH_POUCHES,
+             (int64_t) (BENCH_POUCHES * sizeof(payload)) * MSEC_PER_SEC / elapsed);
+}
+
+ZTEST(uplink_window_bench, test_rtt_20ms)
+{
+    bench_rtt(20);
+}
+
+ZTEST(uplink_window_bench, test_rtt_100ms)
+{
+    bench_rtt(100);
+}
+
+/* Cellular backhaul */
+ZTEST(uplink_window_bench, test_rtt_400ms)
+{
+    bench_rtt(400);
+}
+
+ZTEST(uplink_window_bench, test_retry_before_new_blocks)
+{
+    if (CONFIG_POUCH_GATEWAY_UPLINK_WINDOW < 2)
+    {
+        ztest_test_skip();
+    }
+
+    fake_cloud_reset();
+    fake_cloud_set_rtt(100);
+    fake_cloud_fail_once(1);
+    atomic_clear(&failed);
+
+    send_pouch();
+
+    zassert_equal(atomic_get(&failed), 0);
+    zassert_equal(fake_cloud_bytes(), sizeof(payload));
+
+    const uint32_t *sent;
+    size_t count = fake_cloud_sent(&sent);
+    size_t failed_at = fake_cloud_failed_at();
+
+    /* Only blocks that were in flight with block 1 may be sent before it */
+    zassert_true(failed_at < count);
+    zassert_equal(sent[failed_at], 1, "Block %u overtook the retry", sent[failed_at]);
+}
+
+static void *uplink_window_bench_setup(void)
+{
+    for (size_t i = 0; i < sizeof(payload); i++)
+    {
+        payload[i] = i;
+    }
+
+    pouch_gateway_uplink_module_init(fake_cloud_client);
+
+    return NULL;
+}
+
+ZTEST_SUITE(uplink_window_bench, NULL, uplink_window_bench_setup, NULL, NULL, NULL);